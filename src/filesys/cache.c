@@ -0,0 +1,440 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between write-behind flushes of dirty sectors. */
+#define WRITE_BEHIND_TICKS (5 * TIMER_FREQ)
+
+/* Maximum number of pending read-ahead requests. */
+#define READ_AHEAD_MAX 16
+
+/* Sector number of an empty cache block. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector of the file system device.
+
+   SECTOR, EVICTING, USERS, ACCESSED, and PINNED are protected
+   by cache_lock.  A block with USERS > 0 is never reused for
+   another sector.  While a reused block's old contents are being
+   written back, EVICTING names the old sector, which nobody may
+   look up until the write completes.  A pinned block is neither
+   reused nor written back (see cache_pin()).  The rest of the
+   block is protected by LOCK, which each user holds while it
+   reads or writes DATA. */
+struct cache_block
+  {
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    block_sector_t evicting;            /* Sector being written back. */
+    int users;                          /* Threads using the block. */
+    bool accessed;                      /* Used since clock hand passed? */
+    bool pinned;                        /* Held in cache by journal? */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA holds SECTOR's contents? */
+    bool dirty;                         /* DATA must be written back? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_block cache[CACHE_SECTORS];
+static struct lock cache_lock;
+static struct condition block_released; /* A block's USERS dropped to 0. */
+static struct condition evicted;        /* A block's EVICTING was cleared. */
+static size_t clock_hand;
+
+/* Sectors queued for read-ahead. */
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_ready;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, write_cnt;
+
+static thread_func write_behind_thread NO_RETURN;
+static thread_func read_ahead_thread NO_RETURN;
+
+/* Initializes the buffer cache and starts its write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&block_released);
+  cond_init (&evicted);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      struct cache_block *b = &cache[i];
+      b->sector = NO_SECTOR;
+      b->evicting = NO_SECTOR;
+      b->users = 0;
+      b->accessed = false;
+      b->pinned = false;
+      lock_init (&b->lock);
+      b->valid = false;
+      b->dirty = false;
+    }
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_ready);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
+}
+
+/* Writes B's data back to disk if it is dirty.  The caller must
+   hold B's lock. */
+static void
+write_back (struct cache_block *b)
+{
+  if (b->dirty)
+    {
+      block_write (fs_device, b->sector, b->data);
+      b->dirty = false;
+      write_cnt++;
+    }
+}
+
+/* Returns true if SECTOR's old contents are on their way to
+   disk from a block that is being reused.  The caller must hold
+   cache_lock. */
+static bool
+is_evicting (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].evicting == sector)
+      return true;
+  return false;
+}
+
+/* Returns the block that holds SECTOR, claiming an unused one
+   with the clock algorithm if SECTOR is not cached, and acquires
+   its lock.  The caller must call release_block() when done.
+
+   Writing back a claimed block's old sector happens without
+   cache_lock, so that other threads can keep using the cache in
+   the meantime. */
+static struct cache_block *
+get_block (block_sector_t sector)
+{
+  struct cache_block *b;
+  size_t i;
+
+  ASSERT (sector != NO_SECTOR);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      /* Already cached? */
+      for (i = 0; i < CACHE_SECTORS; i++)
+        {
+          b = &cache[i];
+          if (b->sector == sector)
+            {
+              b->users++;
+              b->accessed = true;
+              hit_cnt++;
+              lock_release (&cache_lock);
+              lock_acquire (&b->lock);
+              return b;
+            }
+        }
+
+      /* If SECTOR is still being written back, reading it from
+         disk now would see stale data. */
+      if (is_evicting (sector))
+        {
+          cond_wait (&evicted, &cache_lock);
+          continue;
+        }
+
+      /* Find an unused block that was not accessed recently.  Two
+         sweeps clear every accessed bit. */
+      for (i = 0; i < 2 * CACHE_SECTORS; i++)
+        {
+          block_sector_t old_sector;
+
+          b = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SECTORS;
+          if (b->users > 0 || b->pinned)
+            continue;
+          if (b->accessed)
+            {
+              b->accessed = false;
+              continue;
+            }
+
+          /* Nobody holds the lock of a block without users, so
+             this does not block. */
+          lock_acquire (&b->lock);
+          old_sector = b->sector;
+          b->sector = sector;
+          b->users = 1;
+          b->accessed = true;
+          b->valid = false;
+          miss_cnt++;
+          if (!b->dirty)
+            {
+              lock_release (&cache_lock);
+              return b;
+            }
+
+          /* Write back the old sector.  Anyone looking for it
+             waits until it is on disk. */
+          b->evicting = old_sector;
+          lock_release (&cache_lock);
+          block_write (fs_device, old_sector, b->data);
+          b->dirty = false;
+          write_cnt++;
+
+          lock_acquire (&cache_lock);
+          b->evicting = NO_SECTOR;
+          cond_broadcast (&evicted, &cache_lock);
+          lock_release (&cache_lock);
+          return b;
+        }
+
+      /* Every block is in use or pinned.  Wait for one to be
+         released. */
+      cond_wait (&block_released, &cache_lock);
+    }
+}
+
+/* Releases block B, obtained from get_block(). */
+static void
+release_block (struct cache_block *b)
+{
+  lock_release (&b->lock);
+
+  lock_acquire (&cache_lock);
+  if (--b->users == 0)
+    cond_signal (&block_released, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = get_block (sector);
+  if (!b->valid)
+    {
+      block_read (fs_device, sector, b->data);
+      b->valid = true;
+    }
+  memcpy (buffer, b->data + ofs, size);
+  release_block (b);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFS within it.  The sector reaches disk later, when it is
+   evicted or flushed. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = get_block (sector);
+  if (!b->valid && size < BLOCK_SECTOR_SIZE)
+    block_read (fs_device, sector, b->data);
+  memcpy (b->data + ofs, buffer, size);
+  b->valid = true;
+  b->dirty = true;
+  release_block (b);
+}
+
+/* Asks for SECTOR to be read into the cache in the background,
+   in anticipation of a later read.  Does nothing if too many
+   requests are already pending. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX)
+    {
+      read_ahead_queue[read_ahead_cnt++] = sector;
+      cond_signal (&read_ahead_ready, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Pins SECTOR in the cache, reading it in if necessary, until
+   cache_unpin() is called for it.  A pinned sector stays in the
+   cache and is not written to disk, even if it is dirty, so that
+   the journal can commit its changes before they reach their
+   home location. */
+void
+cache_pin (block_sector_t sector)
+{
+  struct cache_block *b = get_block (sector);
+
+  if (!b->valid)
+    {
+      block_read (fs_device, sector, b->data);
+      b->valid = true;
+    }
+  lock_acquire (&cache_lock);
+  b->pinned = true;
+  lock_release (&cache_lock);
+  release_block (b);
+}
+
+/* Unpins SECTOR, which must be pinned, so that it can be written
+   back and evicted again. */
+void
+cache_unpin (block_sector_t sector)
+{
+  struct cache_block *b = get_block (sector);
+
+  lock_acquire (&cache_lock);
+  ASSERT (b->pinned);
+  b->pinned = false;
+  lock_release (&cache_lock);
+  release_block (b);
+}
+
+/* Writes block B back to disk if it is dirty and not pinned,
+   then releases it.  The caller must have incremented B's USERS
+   but must not hold its lock.  Returns false if B was pinned,
+   true otherwise. */
+static bool
+flush_block (struct cache_block *b)
+{
+  bool pinned;
+
+  /* A block is pinned only while its lock is held, so checking
+     with the lock held ensures that we do not write back changes
+     made after it was pinned. */
+  lock_acquire (&b->lock);
+  lock_acquire (&cache_lock);
+  pinned = b->pinned;
+  lock_release (&cache_lock);
+  if (!pinned)
+    write_back (b);
+  release_block (b);
+  return !pinned;
+}
+
+/* Writes SECTOR to disk now if it is cached and dirty.
+   Returns true if the disk copy of SECTOR is now up to date,
+   false if SECTOR is pinned. */
+bool
+cache_write_back (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  while (is_evicting (sector))
+    cond_wait (&evicted, &cache_lock);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].sector == sector)
+      {
+        cache[i].users++;
+        lock_release (&cache_lock);
+        return flush_block (&cache[i]);
+      }
+  lock_release (&cache_lock);
+  return true;
+}
+
+/* Writes every dirty cached sector that is not pinned to
+   disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (b->sector == NO_SECTOR)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      b->users++;
+      lock_release (&cache_lock);
+
+      flush_block (b);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  long long total = hit_cnt + miss_cnt;
+  printf ("Cache: %lld hits, %lld misses (%lld%% hit rate), "
+          "%lld sectors written\n",
+          hit_cnt, miss_cnt, total > 0 ? hit_cnt * 100 / total : 0,
+          write_cnt);
+}
+
+/* Periodically writes dirty sectors to disk, so that they are
+   not lost in a crash and eviction rarely has to wait for a
+   write. */
+static void
+write_behind_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Reads in the sectors requested with cache_read_ahead(). */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_block *b;
+      block_sector_t sector;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_ready, &read_ahead_lock);
+      sector = read_ahead_queue[--read_ahead_cnt];
+      lock_release (&read_ahead_lock);
+
+      b = get_block (sector);
+      if (!b->valid)
+        {
+          block_read (fs_device, sector, b->data);
+          b->valid = true;
+        }
+      release_block (b);
+    }
+}
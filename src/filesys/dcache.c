@@ -0,0 +1,200 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Cache of directory lookups: maps a directory's inode sector and
+   a name in it to the inode sector the name refers to, or to 0
+   if the directory has no such name.  (Sector 0 holds the free
+   map's inode, so no directory entry refers to it.)
+
+   Entries are kept up to date by dir_add() and dir_remove(), so
+   a hit never needs to read the directory.  Those and
+   dir_lookup()'s fill after a miss all run under the directory
+   inode's operation lock, so a result read from disk cannot be
+   cached after a change has made it stale. */
+
+/* Maximum number of cached names. */
+#define DCACHE_MAX 512
+
+/* A cached name. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name in directory. */
+    block_sector_t sector;              /* Inode sector, or 0 if absent. */
+  };
+
+static struct hash dcache;
+static struct list lru_list;            /* Most recently used first. */
+static size_t dcache_cnt;
+static struct lock dcache_lock;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt;
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+
+/* Initializes the directory lookup cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dcache, dcache_hash, dcache_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  The caller must hold dcache_lock. */
+static struct dcache_entry *
+find_entry (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Removes entry E from the cache and frees it.  The caller must
+   hold dcache_lock. */
+static void
+remove_entry (struct dcache_entry *e)
+{
+  hash_delete (&dcache, &e->hash_elem);
+  list_remove (&e->lru_elem);
+  dcache_cnt--;
+  free (e);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   If the result is cached, stores the sector of NAME's inode in
+   *SECTORP, or 0 if DIR has no file named NAME, and returns
+   true.  Otherwise, returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = find_entry (dir, name);
+  if (e != NULL)
+    {
+      *sectorp = e->sector;
+      list_remove (&e->lru_elem);
+      list_push_front (&lru_list, &e->lru_elem);
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR refers to the inode in SECTOR, or that DIR has no file
+   named NAME if SECTOR is 0.  Replaces any cached entry for NAME
+   in DIR, and evicts the least recently used entry if the cache
+   is full.  Names too long to be in a directory are not cached,
+   and neither is anything if memory is short. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t sector)
+{
+  struct dcache_entry *e;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = find_entry (dir, name);
+  if (e == NULL)
+    {
+      if (dcache_cnt >= DCACHE_MAX)
+        remove_entry (list_entry (list_back (&lru_list),
+                                  struct dcache_entry, lru_elem));
+      e = malloc (sizeof *e);
+      if (e != NULL)
+        {
+          e->dir = dir;
+          strlcpy (e->name, name, sizeof e->name);
+          hash_insert (&dcache, &e->hash_elem);
+          list_push_front (&lru_list, &e->lru_elem);
+          dcache_cnt++;
+        }
+    }
+  else
+    {
+      list_remove (&e->lru_elem);
+      list_push_front (&lru_list, &e->lru_elem);
+    }
+  if (e != NULL)
+    e->sector = sector;
+  lock_release (&dcache_lock);
+}
+
+/* Drops every cached name in the directory whose inode is in
+   sector DIR.  Called when a new directory is created in DIR, in
+   case DIR previously held another directory. */
+void
+dcache_forget_dir (block_sector_t dir)
+{
+  struct list_elem *elem;
+
+  lock_acquire (&dcache_lock);
+  for (elem = list_begin (&lru_list); elem != list_end (&lru_list); )
+    {
+      struct dcache_entry *e = list_entry (elem, struct dcache_entry,
+                                           lru_elem);
+      elem = list_next (elem);
+      if (e->dir == dir)
+        remove_entry (e);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory lookup cache statistics. */
+void
+dcache_print_stats (void)
+{
+  long long total = hit_cnt + miss_cnt;
+  printf ("Dcache: %lld hits, %lld misses (%lld%% hit rate)\n",
+          hit_cnt, miss_cnt, total > 0 ? hit_cnt * 100 / total : 0);
+}
+
+/* Returns a hash value for the dcache entry E. */
+static unsigned
+dcache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct dcache_entry *e = hash_entry (e_, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (e->name) ^ hash_int (e->dir);
+}
+
+/* Returns true if dcache entry A precedes B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
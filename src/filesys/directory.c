@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -21,12 +25,56 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory is a hash table of names.  Its file is divided
+   into sector-sized blocks.  Blocks 0 through BUCKET_CNT - 1 are
+   the heads of the buckets, and a bucket that fills up is
+   continued in an overflow block appended to the end of the
+   file.  A bucket that has never been written is a hole in the
+   file and reads as empty, but each bucket in use takes a whole
+   sector, so a directory of a few dozen names takes several
+   times the space of a flat array of entries.
+
+   Adding or removing a name reads and then writes the directory,
+   so it holds the directory inode's operation lock throughout
+   (see inode_lock()). */
+#define BUCKET_CNT 128
+
+/* Number of entries in a block. */
+#define BLOCK_ENTRY_CNT ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                         / sizeof (struct dir_entry))
+
+/* A block of directory entries. */
+struct dir_block
+  {
+    struct dir_entry entries[BLOCK_ENTRY_CNT];
+    uint32_t next;                      /* Next block in chain, or 0. */
+  };
+
+/* Returns the byte offset in a directory of block BLOCK_IDX. */
+static off_t
+block_ofs (uint32_t block_idx)
+{
+  return block_idx * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the bucket that NAME hashes to. */
+static uint32_t
+bucket_of (const char *name)
+{
+  return hash_string (name) % BUCKET_CNT;
+}
+
+/* Creates an empty directory in the given SECTOR.  ENTRY_CNT is
+   only a hint: buckets are allocated as they fill.  Buckets fill
+   in hash order, which would scatter an extent inode into more
+   runs than it can hold, so directories always use the indexed
+   format.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt UNUSED)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  dcache_forget_dir (sector);
+  return inode_create_indexed (sector, 0);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -37,6 +85,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      inode_journal_data (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -83,51 +132,123 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Reads block BLOCK_IDX of DIR into B.  A block past the end of
+   the directory reads as empty. */
+static void
+read_block (const struct dir *dir, uint32_t block_idx, struct dir_block *b)
+{
+  off_t n = inode_read_at (dir->inode, b, sizeof *b, block_ofs (block_idx));
+  memset ((char *) b + n, 0, sizeof *b - n);
+}
+
+/* Searches the bucket for NAME in DIR, using B as scratch space.
+   If successful, returns true, sets *EP to the directory entry
+   if EP is non-null, and sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null.
+   Otherwise, returns false, sets *FREE_OFSP to the byte offset
+   of the first free entry in the bucket, or -1 if it has none,
+   if FREE_OFSP is non-null, and sets *TAILP to the last block in
+   the bucket's chain if TAILP is non-null. */
+static bool
+scan_bucket (const struct dir *dir, const char *name, struct dir_block *b,
+             struct dir_entry *ep, off_t *ofsp,
+             off_t *free_ofsp, uint32_t *tailp)
+{
+  uint32_t block_idx = bucket_of (name);
+  off_t free_ofs = -1;
+
+  for (;;)
+    {
+      size_t i;
+
+      read_block (dir, block_idx, b);
+      for (i = 0; i < BLOCK_ENTRY_CNT; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          off_t ofs = block_ofs (block_idx) + i * sizeof *e;
+
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          else if (!e->in_use && free_ofs == -1)
+            free_ofs = ofs;
+        }
+      if (b->next == 0)
+        break;
+      block_idx = b->next;
+    }
+
+  if (free_ofsp != NULL)
+    *free_ofsp = free_ofs;
+  if (tailp != NULL)
+    *tailp = block_idx;
+  return false;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.  Then
+   *ERRORP, if ERRORP is non-null, tells whether NAME is known to
+   be absent (false) or the search could not be made because
+   memory ran out (true). */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, off_t *ofsp, bool *errorp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_block *b;
+  bool found;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  b = malloc (sizeof *b);
+  if (errorp != NULL)
+    *errorp = b == NULL;
+  if (b == NULL)
+    return false;
+  found = scan_bucket (dir, name, b, ep, ofsp, NULL, NULL);
+  free (b);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names looked up recently are found in the dcache without
+   reading DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector;
+  block_sector_t sector;
   struct dir_entry e;
+  bool error;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  /* On a miss, scan and cache the result under the directory's
+     operation lock, so that an add or remove cannot slip in
+     between and leave a stale entry behind. */
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      inode_lock (dir->inode);
+      sector = lookup (dir, name, &e, NULL, &error) ? e.inode_sector : 0;
+      if (!error)
+        dcache_insert (dir_sector, name, sector);
+      inode_unlock (dir->inode);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
 
   return *inode != NULL;
 }
@@ -141,8 +262,10 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_block *b;
   struct dir_entry e;
   off_t ofs;
+  uint32_t tail;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +275,50 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  /* Check that NAME is not in use, and find a free slot in its
+     bucket.  Another thread adding to the same bucket must not
+     take the same slot or overflow block. */
+  journal_begin ();
+  inode_lock (dir->inode);
+  if (scan_bucket (dir, name, b, NULL, NULL, &ofs, &tail))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+
+  if (ofs != -1)
+    success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  else
+    {
+      /* The bucket is full.  Write a new overflow block holding
+         just E at the end of the directory, then link it to the
+         end of the bucket's chain. */
+      uint32_t block_idx = DIV_ROUND_UP (inode_length (dir->inode),
+                                         BLOCK_SECTOR_SIZE);
+      if (block_idx < BUCKET_CNT)
+        block_idx = BUCKET_CNT;
+
+      memset (b, 0, sizeof *b);
+      b->entries[0] = e;
+      success = (inode_write_at (dir->inode, b, sizeof *b,
+                                 block_ofs (block_idx)) == sizeof *b
+                 && inode_write_at (dir->inode, &block_idx, sizeof block_idx,
+                                    (block_ofs (tail)
+                                     + offsetof (struct dir_block, next)))
+                    == sizeof block_idx);
+    }
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  inode_unlock (dir->inode);
+  journal_end ();
+  free (b);
   return success;
 }
 
@@ -193,7 +337,9 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  journal_begin ();
+  inode_lock (dir->inode);
+  if (!lookup (dir, name, &e, &ofs, NULL))
     goto done;
 
   /* Open inode. */
@@ -207,10 +353,13 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
 
   /* Remove inode. */
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
+  journal_end ();
   inode_close (inode);
   return success;
 }
@@ -223,8 +372,19 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (dir->pos < inode_length (dir->inode))
     {
+      off_t ofs = dir->pos % BLOCK_SECTOR_SIZE;
+
+      /* Skip the chain pointer at the end of each block. */
+      if (ofs / sizeof e >= BLOCK_ENTRY_CNT)
+        {
+          dir->pos += BLOCK_SECTOR_SIZE - ofs;
+          continue;
+        }
+
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
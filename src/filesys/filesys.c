@@ -2,9 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 
 /* Partition that contains the file system. */
@@ -21,6 +24,9 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  journal_init (format);
+  dcache_init ();
   inode_init ();
   free_map_init ();
 
@@ -36,6 +42,8 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,12 +55,21 @@ filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  block_sector_t dir_sector;
+  bool success;
+
+  /* Allocate the inode, initialize it, and add it to the
+     directory as one journaled operation.  Put the new inode
+     near its directory's. */
+  dir_sector = dir != NULL ? inode_get_inumber (dir_get_inode (dir)) : 0;
+  journal_begin ();
+  success = (dir != NULL
+             && free_map_allocate_near (dir_sector, 1, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
   dir_close (dir);
 
   return success;
@@ -84,7 +101,11 @@ bool
 filesys_remove (const char *name) 
 {
   struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  bool success;
+
+  journal_begin ();
+  success = dir != NULL && dir_remove (dir, name);
+  journal_end ();
   dir_close (dir); 
 
   return success;
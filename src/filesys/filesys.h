@@ -8,6 +8,9 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* First sector of the metadata journal. */
+#define JOURNAL_SECTOR 2
+
 /* Block device that contains the file system. */
 extern struct block *fs_device;
 
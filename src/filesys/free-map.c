@@ -1,12 +1,62 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map. */
+
+/* The device is divided into allocation groups of GROUP_SECTORS
+   sectors each.  free_map_allocate_near() keeps related sectors
+   in the same group where it can, and uses the count of free
+   sectors in each group to skip groups that are too full. */
+#define GROUP_SECTORS 512
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+/* Returns the group that contains SECTOR. */
+static size_t
+group_of (block_sector_t sector)
+{
+  return sector / GROUP_SECTORS;
+}
+
+/* Returns the number of sectors in GROUP. */
+static size_t
+group_size (size_t group)
+{
+  size_t end = (group + 1) * GROUP_SECTORS;
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  return end - group * GROUP_SECTORS;
+}
+
+/* Adds DELTA to the free count of each group for each of the CNT
+   sectors starting at SECTOR. */
+static void
+adjust_group_free (block_sector_t sector, size_t cnt, int delta)
+{
+  for (; cnt > 0; sector++, cnt--)
+    group_free[group_of (sector)] += delta;
+}
+
+/* Recounts the free sectors in every group. */
+static void
+count_group_free (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    group_free[g] = bitmap_count (free_map, g * GROUP_SECTORS,
+                                  group_size (g), false);
+}
 
 /* Initializes the free map. */
 void
@@ -17,6 +67,109 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  lock_init (&free_map_lock);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("can't allocate allocation group counts");
+  count_group_free ();
+}
+
+/* Returns the first run of CNT free sectors within GROUP that
+   starts at or after sector START, or BITMAP_ERROR if there is
+   none.  The caller must hold free_map_lock. */
+static block_sector_t
+scan_group (size_t group, block_sector_t start, size_t cnt)
+{
+  size_t end = group * GROUP_SECTORS + group_size (group);
+
+  if (group_free[group] < cnt)
+    return BITMAP_ERROR;
+  return bitmap_scan_range (free_map, start, end, cnt, false);
+}
+
+/* Returns the first sector of a run of CNT free sectors, chosen
+   to be near HINT, or BITMAP_ERROR if there is none.  Looks in
+   HINT's group first, starting at HINT, then in the other groups
+   in order of distance from HINT's.  Each of those scans stays
+   within its group.  Only when no group holds the whole run does
+   it scan the entire device, for a run that spans groups.  The
+   caller must hold free_map_lock. */
+static block_sector_t
+find_free (block_sector_t hint, size_t cnt)
+{
+  block_sector_t sector;
+  size_t home, d;
+
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  home = group_of (hint);
+  sector = scan_group (home, hint, cnt);
+  if (sector != BITMAP_ERROR)
+    return sector;
+  for (d = 0; d < group_cnt; d++)
+    {
+      if (home + d < group_cnt)
+        {
+          sector = scan_group (home + d, (home + d) * GROUP_SECTORS, cnt);
+          if (sector != BITMAP_ERROR)
+            return sector;
+        }
+      if (d > 0 && d <= home)
+        {
+          sector = scan_group (home - d, (home - d) * GROUP_SECTORS, cnt);
+          if (sector != BITMAP_ERROR)
+            return sector;
+        }
+    }
+
+  /* No single group has room: fall back to a run that spans
+     groups. */
+  return bitmap_scan (free_map, 0, cnt, false);
+}
+
+/* Marks the CNT sectors starting at SECTOR, which must be free,
+   as allocated, and writes the change to the free map file.
+   Returns true if successful, false if the free map file could
+   not be written, in which case the sectors stay free.  The
+   caller must hold free_map_lock. */
+static bool
+mark_allocated (block_sector_t sector, size_t cnt)
+{
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false); 
+      return false;
+    }
+  adjust_group_free (sector, cnt, -1);
+  return true;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   as possible to sector HINT, and stores the first into
+   *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  sector = find_free (hint, cnt);
+  success = sector != BITMAP_ERROR && mark_allocated (sector, cnt);
+  lock_release (&free_map_lock);
+
+  if (success)
+    *sectorp = sector;
+  return success;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +180,37 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Allocates the CNT sectors starting at SECTOR, if all of them
+   are free.
+   Returns true if successful, false if any of them is in use or
+   past the end of the device or if the free_map file could not
+   be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = (sector + cnt <= bitmap_size (free_map)
+             && bitmap_none (free_map, sector, cnt)
+             && mark_allocated (sector, cnt));
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  adjust_group_free (sector, cnt, +1);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,8 +220,10 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_journal_data (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_group_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +238,23 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The first write allocates the file's
+     sectors, which changes the bitmap but must not itself write
+     to the free map file, so it is done before free_map_file is
+     set.  The second write records those allocations. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
+  inode_journal_data (file_get_inode (file));
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
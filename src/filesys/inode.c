@@ -1,76 +1,406 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Identify an inode and its format. */
+#define INODE_MAGIC 0x494e4f44          /* Indexed inode. */
+#define EXTENT_MAGIC 0x45585453         /* Extent-based inode. */
+
+/* Sector pointers in an inode: DIRECT_CNT pointers to data
+   sectors, then one to an indirect block, then one to a doubly
+   indirect block.  A pointer of 0 means the sector has not been
+   allocated and reads as zeros (sector 0 always holds the free
+   map's inode, so it is never file data). */
+#define DIRECT_CNT 124
+#define INDIRECT_IDX DIRECT_CNT
+#define DBL_INDIRECT_IDX (DIRECT_CNT + 1)
+#define SECTOR_PTR_CNT (DIRECT_CNT + 2)
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest file, in sectors. */
+#define MAX_FILE_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                          + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* A run of LENGTH consecutive file sectors, starting at file
+   sector FIRST, stored in consecutive device sectors starting at
+   START. */
+struct extent
+  {
+    uint32_t first;                     /* First file sector. */
+    block_sector_t start;               /* First device sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Number of extents in an extent-based inode. */
+#define EXTENT_CNT (SECTOR_PTR_CNT * sizeof (block_sector_t) \
+                    / sizeof (struct extent))
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   An inode with magic number INODE_MAGIC finds its data through
+   SECTORS.  One with EXTENT_MAGIC uses EXTENTS instead, which
+   are sorted by FIRST, do not overlap, and are packed at the
+   front of the array; unused extents have LENGTH 0.  File
+   sectors in neither format's map are holes. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        block_sector_t sectors[SECTOR_PTR_CNT]; /* Indexed format. */
+        struct extent extents[EXTENT_CNT];      /* Extent format. */
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* -extents: Create new inodes in the extent format? */
+bool inode_use_extents;
+
+/* Key of an open inode in open_inodes.  Kept apart from the
+   rest of the inode so that a lookup can probe with just a
+   sector number. */
+struct inode_key
+  {
+    struct hash_elem elem;              /* Element in open_inodes. */
+    block_sector_t sector;              /* Sector number of disk location. */
+  };
 
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
-    block_sector_t sector;              /* Sector number of disk location. */
+    struct inode_key key;               /* Key in open_inodes. */
     int open_cnt;                       /* Number of openers. */
+    bool loaded;                        /* DATA read from disk yet? */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool journal_data;                  /* Journal data, not just inode? */
+    struct lock lock;                   /* Protects DATA's sector map. */
+    struct lock op_lock;                /* Held by inode_lock() callers. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* A sector's worth of zeros, for initializing new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates a sector as close as possible to HINT, fills it with
+   zeros, and stores its number in *SECTORP.  If INDEX is true,
+   the sector will be an index block, so it is journaled;
+   otherwise it is data, which must reach disk before the commit.
+   Returns true if successful, false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t hint, block_sector_t *sectorp, bool index)
+{
+  if (!free_map_allocate_near (hint, 1, sectorp))
+    return false;
+  if (index)
+    journal_log (*sectorp);
+  else
+    journal_order (*sectorp);
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the sector that pointer IDX in the inode DISK, stored
+   in sector INODE_SECTOR, points to.  If it is 0 and ALLOCATE is
+   true, allocates a zeroed sector, points it there, and writes
+   DISK back.  Returns 0 if there is no such sector.  The pointer
+   is set only once the new sector is zeroed, so that nobody can
+   follow it to stale data. */
+static block_sector_t
+get_inode_ptr (struct inode_disk *disk, block_sector_t inode_sector,
+               size_t idx, bool allocate)
+{
+  block_sector_t sector;
+
+  if (disk->sectors[idx] == 0 && allocate
+      && allocate_zeroed (inode_sector, &sector, idx >= DIRECT_CNT))
+    {
+      disk->sectors[idx] = sector;
+      journal_log (inode_sector);
+      cache_write (inode_sector, disk);
+    }
+  return disk->sectors[idx];
+}
+
+/* Like get_inode_ptr(), for pointer IDX in the indirect block
+   in sector INDEX_SECTOR.  INDEX is true if the pointer is to
+   another index block rather than to data. */
+static block_sector_t
+get_index_ptr (block_sector_t index_sector, size_t idx, bool allocate,
+               bool index)
+{
+  block_sector_t sector;
+  int ofs = idx * sizeof sector;
+
+  cache_read_at (index_sector, &sector, ofs, sizeof sector);
+  if (sector == 0 && allocate
+      && allocate_zeroed (index_sector, &sector, index))
+    {
+      journal_log (index_sector);
+      cache_write_at (index_sector, &sector, ofs, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns the block device sector that holds data sector
+   SECTOR_IDX of the indexed inode DISK, stored in sector
+   INODE_SECTOR.
+   If that sector, or an index block on the way to it, has not
+   been allocated, then allocates it if ALLOCATE is true, and
+   otherwise returns 0.  Also returns 0 if allocation fails or
+   SECTOR_IDX is past the largest possible file. */
+static block_sector_t
+index_lookup (struct inode_disk *disk, block_sector_t inode_sector,
+              size_t sector_idx, bool allocate)
+{
+  block_sector_t index;
+
+  if (sector_idx < DIRECT_CNT)
+    return get_inode_ptr (disk, inode_sector, sector_idx, allocate);
+  sector_idx -= DIRECT_CNT;
+
+  if (sector_idx < PTRS_PER_SECTOR)
+    {
+      index = get_inode_ptr (disk, inode_sector, INDIRECT_IDX, allocate);
+      return (index != 0
+              ? get_index_ptr (index, sector_idx, allocate, false)
+              : 0);
+    }
+  sector_idx -= PTRS_PER_SECTOR;
+
+  if (sector_idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      index = get_inode_ptr (disk, inode_sector, DBL_INDIRECT_IDX, allocate);
+      if (index != 0)
+        index = get_index_ptr (index, sector_idx / PTRS_PER_SECTOR,
+                               allocate, true);
+      return (index != 0
+              ? get_index_ptr (index, sector_idx % PTRS_PER_SECTOR,
+                               allocate, false)
+              : 0);
+    }
+  return 0;
+}
+
+/* Returns the number of extents in use in DISK. */
+static size_t
+extent_cnt (const struct inode_disk *disk)
+{
+  size_t cnt;
+
+  for (cnt = 0; cnt < EXTENT_CNT && disk->extents[cnt].length > 0; cnt++)
+    continue;
+  return cnt;
+}
+
+/* Returns the index of the first extent in DISK, which has CNT
+   extents, whose first file sector is after SECTOR_IDX.  Returns
+   CNT if there is none. */
+static size_t
+extent_search (const struct inode_disk *disk, size_t cnt, size_t sector_idx)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (disk->extents[mid].first <= sector_idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Tries to claim device sector SECTOR for data, and zeros it if
+   successful. */
+static bool
+claim_zeroed (block_sector_t sector)
+{
+  if (!free_map_allocate_at (sector, 1))
+    return false;
+  journal_order (sector);
+  cache_write (sector, zeros);
+  return true;
+}
+
+/* Adds file sector SECTOR_IDX, which must not already be mapped,
+   to the extent inode DISK, stored in sector INODE_SECTOR.
+   Grows the extent before or after SECTOR_IDX in place if the
+   device sector next to it is free, so that sequential writes
+   stay in one contiguous run, and otherwise starts a new extent.
+   Returns the new sector, which is zeroed, or 0 if the disk is
+   full or DISK has no free extent. */
+static block_sector_t
+extent_allocate (struct inode_disk *disk, block_sector_t inode_sector,
+                 size_t sector_idx)
+{
+  size_t cnt = extent_cnt (disk);
+  size_t pos = extent_search (disk, cnt, sector_idx);
+  struct extent *prev = pos > 0 ? &disk->extents[pos - 1] : NULL;
+  struct extent *next = pos < cnt ? &disk->extents[pos] : NULL;
+  block_sector_t sector;
+
+  if (prev != NULL && prev->first + prev->length == sector_idx
+      && claim_zeroed (prev->start + prev->length))
+    {
+      sector = prev->start + prev->length++;
+
+      /* Merge with NEXT if this filled the gap between them. */
+      if (next != NULL && next->first == sector_idx + 1
+          && next->start == sector + 1)
+        {
+          prev->length += next->length;
+          memmove (next, next + 1, (cnt - pos - 1) * sizeof *next);
+          memset (&disk->extents[cnt - 1], 0, sizeof *next);
+        }
+    }
+  else if (next != NULL && next->first == sector_idx + 1
+           && next->start > 0 && claim_zeroed (next->start - 1))
+    {
+      sector = --next->start;
+      next->first--;
+      next->length++;
+    }
+  else if (cnt < EXTENT_CNT
+           && allocate_zeroed (prev != NULL ? prev->start + prev->length
+                                            : inode_sector,
+                               &sector, false))
+    {
+      memmove (&disk->extents[pos + 1], &disk->extents[pos],
+               (cnt - pos) * sizeof *disk->extents);
+      disk->extents[pos].first = sector_idx;
+      disk->extents[pos].start = sector;
+      disk->extents[pos].length = 1;
+    }
+  else
+    return 0;
+
+  journal_log (inode_sector);
+  cache_write (inode_sector, disk);
+  return sector;
+}
+
+/* Returns the block device sector that holds data sector
+   SECTOR_IDX of the extent inode DISK, stored in sector
+   INODE_SECTOR, allocating it if it is a hole and ALLOCATE is
+   true.  Returns 0 for a hole that is not allocated.
+   extent_allocate() shifts and merges extents in place, so the
+   search must not overlap an allocation: callers hold the
+   inode's lock, even just to read. */
+static block_sector_t
+extent_lookup (struct inode_disk *disk, block_sector_t inode_sector,
+               size_t sector_idx, bool allocate)
+{
+  size_t pos = extent_search (disk, extent_cnt (disk), sector_idx);
+
+  if (pos > 0)
+    {
+      struct extent *e = &disk->extents[pos - 1];
+      if (sector_idx < e->first + e->length)
+        return e->start + (sector_idx - e->first);
+    }
+  return allocate ? extent_allocate (disk, inode_sector, sector_idx) : 0;
+}
+
+/* Returns the block device sector that holds data sector
+   SECTOR_IDX of DISK, stored in sector INODE_SECTOR, in either
+   format.  See index_lookup() for the meaning of ALLOCATE and
+   the return value. */
+static block_sector_t
+lookup_sector (struct inode_disk *disk, block_sector_t inode_sector,
+               size_t sector_idx, bool allocate)
+{
+  if (disk->magic == EXTENT_MAGIC)
+    return extent_lookup (disk, inode_sector, sector_idx, allocate);
+  else
+    return index_lookup (disk, inode_sector, sector_idx, allocate);
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, allocating it if ALLOCATE is true.
+   Returns 0 if there is no sector there: a hole that reads as
+   zeros, or a failed allocation.  The caller must hold INODE's
+   lock. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool allocate)
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  return lookup_sector (&inode->data, inode->key.sector,
+                        pos / BLOCK_SECTOR_SIZE, allocate);
+}
+
+/* Frees SECTOR, an index block at depth LEVEL (1 for an indirect
+   block, 2 for a doubly indirect block) or a data sector (LEVEL
+   0), along with every sector it points to. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  if (level > 0)
+    {
+      block_sector_t ptrs[PTRS_PER_SECTOR];
+      size_t i;
+
+      cache_read (sector, ptrs);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        if (ptrs[i] != 0)
+          release_tree (ptrs[i], level - 1);
+    }
+  free_map_release (sector, 1);
+}
+
+/* Frees all of the data and index sectors of the inode DISK. */
+static void
+release_sectors (struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->magic == EXTENT_MAGIC)
+    {
+      for (i = 0; i < EXTENT_CNT && disk->extents[i].length > 0; i++)
+        free_map_release (disk->extents[i].start, disk->extents[i].length);
+      return;
+    }
+  for (i = 0; i < SECTOR_PTR_CNT; i++)
+    if (disk->sectors[i] != 0)
+      release_tree (disk->sectors[i],
+                    i < DIRECT_CNT ? 0 : i == INDIRECT_IDX ? 1 : 2);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and each inode's OPEN_CNT and LOADED. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
-bool
-inode_create (block_sector_t sector, off_t length)
+/* Initializes an inode with LENGTH bytes of data and the given
+   MAGIC, and writes the new inode to sector SECTOR on the file
+   system device.  Returns true if successful. */
+static bool
+create (block_sector_t sector, off_t length, unsigned magic)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,60 +414,107 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->magic = magic;
+      success = (magic == EXTENT_MAGIC
+                 || ((size_t) DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE)
+                     <= MAX_FILE_SECTORS));
+      if (success)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+          journal_begin ();
+          journal_log (sector);
+          cache_write (sector, disk_inode);
+          journal_end ();
+        }
       free (disk_inode);
     }
   return success;
 }
 
+/* Initializes an inode with LENGTH bytes of data and
+   writes the new inode to sector SECTOR on the file system
+   device.  The data starts out as one hole that reads as zeros;
+   sectors are allocated only as they are written.  The inode
+   uses the extent format if -extents was given.
+   Returns true if successful.
+   Returns false if memory allocation fails or LENGTH is larger
+   than the largest possible file. */
+bool
+inode_create (block_sector_t sector, off_t length)
+{
+  return create (sector, length,
+                 inode_use_extents ? EXTENT_MAGIC : INODE_MAGIC);
+}
+
+/* Like inode_create(), but always uses the indexed format, for
+   files such as directories that are written sparsely and out of
+   order and so would need more extents than an inode holds. */
+bool
+inode_create_indexed (block_sector_t sector, off_t length)
+{
+  return create (sector, length, INODE_MAGIC);
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode_key key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+
+  /* Check whether this inode is already open.  If another opener
+     is still reading it in, wait for it by taking its lock. */
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, key.elem);
+      inode->open_cnt++;
+      if (!inode->loaded)
         {
-          inode_reopen (inode);
-          return inode; 
+          lock_release (&open_inodes_lock);
+          lock_acquire (&inode->lock);
+          lock_release (&inode->lock);
         }
+      else
+        lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  /* Initialize, and publish the inode before reading it, holding
+     its lock so that other openers wait for the read without
+     holding up opens and closes of other inodes. */
+  inode->key.sector = sector;
   inode->open_cnt = 1;
+  inode->loaded = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->journal_data = false;
+  lock_init (&inode->lock);
+  lock_init (&inode->op_lock);
+  lock_acquire (&inode->lock);
+  hash_insert (&open_inodes, &inode->key.elem);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->key.sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loaded = true;
+  lock_release (&open_inodes_lock);
+  lock_release (&inode->lock);
   return inode;
 }
 
@@ -146,7 +523,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -154,7 +535,7 @@ inode_reopen (struct inode *inode)
 block_sector_t
 inode_get_inumber (const struct inode *inode)
 {
-  return inode->sector;
+  return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
@@ -163,22 +544,30 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* Remove from the open inode table if this was the last
+     opener. */
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->key.elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin ();
+          release_sectors (&inode->data);
+          free_map_release (inode->key.sector, 1);
+          journal_end ();
         }
 
       free (inode); 
@@ -196,18 +585,19 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   INODE's lock is held only while finding each sector, since a
+   concurrent write may be changing the index. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,47 +610,59 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Holes read as zeros. */
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset, false);
+      lock_release (&inode->lock);
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Start reading the sector after the last one read, in case
+     the caller is reading sequentially. */
+  if (bytes_read > 0)
+    {
+      off_t next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      if (next < inode_length (inode))
+        {
+          block_sector_t sector;
+
+          lock_acquire (&inode->lock);
+          sector = byte_to_sector (inode, next, false);
+          lock_release (&inode->lock);
+          if (sector != 0)
+            cache_read_ahead (sector);
+        }
+    }
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.  Writing past end of file extends the inode;
+   sectors between the old end of file and OFFSET that are
+   never written stay unallocated.
+
+   Each sector is written in a journal operation of its own, so
+   that a long write never needs more than JOURNAL_OP_MAX journal
+   sectors at once.  Within an outer operation, the whole write
+   joins that one instead. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,55 +670,78 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      /* Allocating sectors and extending the file change
+         metadata.  The journal operation must start before
+         INODE's lock is acquired, because starting one may wait
+         for a commit. */
+      journal_begin ();
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset, true);
+      if (sector_idx != 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (inode->journal_data)
+            journal_log (sector_idx);
+          cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
+
+          /* Extend the file only after its new data is in place,
+             so that a concurrent reader never sees bytes that
+             were not written. */
+          if (offset + chunk_size > inode->data.length)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              inode->data.length = offset + chunk_size;
+              journal_log (inode->key.sector);
+              cache_write (inode->key.sector, &inode->data);
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
         }
+      lock_release (&inode->lock);
+      journal_end ();
+      if (sector_idx == 0)
+        break;
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
 
+/* Acquires INODE's operation lock, which serializes sequences of
+   reads and writes that must appear atomic to each other, such
+   as adding a name to a directory.  An operation that writes
+   must call journal_begin() first, since starting a journal
+   operation may wait for a commit. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->op_lock);
+}
+
+/* Releases INODE's operation lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->op_lock);
+}
+
+/* Journals writes to INODE's data, not just to its inode and
+   index blocks, for files such as directories whose contents are
+   metadata. */
+void
+inode_journal_data (struct inode *inode)
+{
+  inode->journal_data = true;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -343,3 +768,21 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns a hash value for the open inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode_key *key = hash_entry (e, struct inode_key, elem);
+  return hash_int (key->sector);
+}
+
+/* Returns true if open inode A precedes open inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode_key *a = hash_entry (a_, struct inode_key, elem);
+  const struct inode_key *b = hash_entry (b_, struct inode_key, elem);
+  return a->sector < b->sector;
+}
@@ -0,0 +1,413 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Each operation that changes metadata, such as creating or
+   removing a file, runs between journal_begin() and
+   journal_end(), and calls journal_log() for each metadata
+   sector before changing it in the buffer cache.  journal_log()
+   pins the sector in the cache, so that none of the operation's
+   changes reach their home locations on disk yet.
+
+   All the operations that run between commits form one compound
+   transaction.  A commit copies the cached contents of every
+   sector the transaction logged into the journal area, then
+   writes the journal header, which lists the sectors' home
+   locations, in a single sector write.  That write is the commit
+   point.  After it, the sectors are unpinned and reach their
+   home locations through the buffer cache as usual.
+
+   Before the next commit reuses the journal area, it makes sure
+   that every sector in the previous one has reached its home
+   location.  After a crash, journal_init() copies the committed
+   sectors from the journal to their home locations.
+
+   Only metadata is journaled: inodes, index blocks, directory
+   contents, and the free map.  File data is written through the
+   buffer cache without ordering against the journal, with one
+   exception: a data sector allocated by an operation is passed
+   to journal_order(), and the commit writes it home before the
+   header, so that a committed pointer never leads to whatever a
+   freed sector held before.
+
+   Each operation may log and order at most JOURNAL_OP_MAX
+   sectors, and journal_begin() reserves that much room in the
+   running transaction, committing first if there is not enough.
+   So a transaction never overflows the journal area.  A long
+   write is split into one operation per sector for this reason
+   (see inode_write_at()).
+
+   Operations nest: a journal_begin() inside another operation by
+   the same thread joins it rather than starting a new one, so
+   inode_write_at() can be called from filesys_create() and the
+   like.  An operation must not touch user memory, though.  A
+   page fault there could evict a memory-mapped page and write it
+   back to its file, starting a nested operation that takes that
+   file's inode lock inside whatever the outer one holds.  System
+   calls copy user data before and after calling into the file
+   system instead (see sys_read()). */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors one transaction can log, one journal sector
+   each.  Every logged sector stays pinned in the buffer cache
+   until the commit, and the commit waits for running operations
+   to end.  An operation that found the cache full of pinned
+   blocks would wait forever, so the transaction must leave most
+   of the cache free. */
+#define JOURNAL_MAX (JOURNAL_SECTORS - 1)
+#if JOURNAL_MAX > CACHE_SECTORS * 3 / 8
+#error "Journal transactions could pin most of the buffer cache."
+#endif
+
+/* Most sectors one operation can log or order.  Writing one
+   sector of a file logs at most its inode, two new index blocks
+   and the pointers to them, and the free map, and orders the
+   data sector; creating or removing a file takes a few more. */
+#define JOURNAL_OP_MAX 12
+
+/* Ticks between commits by the commit thread. */
+#define COMMIT_TICKS TIMER_FREQ
+
+/* Journal header, in sector JOURNAL_SECTOR.  The committed copy
+   of SECTORS[i] is in sector JOURNAL_SECTOR + 1 + i.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Commit sequence number. */
+    uint32_t cnt;                       /* Committed sectors, 0 if none. */
+    block_sector_t sectors[125];        /* Home sectors. */
+  };
+
+/* Header as last written to disk. */
+static struct journal_header header;
+
+/* Running transaction. */
+static block_sector_t txn_sectors[JOURNAL_MAX]; /* Logged sectors. */
+static size_t txn_cnt;                  /* Number of logged sectors. */
+static block_sector_t order_sectors[JOURNAL_MAX]; /* Ordered data. */
+static size_t order_cnt;                /* Number of ordered sectors. */
+static size_t reserved_cnt;             /* Room promised to handles. */
+static int handle_cnt;                  /* Operations in progress. */
+static int op_cnt;                      /* Operations so far. */
+
+/* Protects the running transaction.  Held throughout a commit. */
+static struct lock journal_lock;
+static bool committing;                 /* Commit waiting or running? */
+static struct condition handles_done;   /* HANDLE_CNT dropped to 0. */
+static struct condition commit_done;    /* Commit finished. */
+
+/* Statistics. */
+static long long commit_cnt, logged_cnt, committed_op_cnt, ordered_cnt;
+
+static thread_func commit_thread NO_RETURN;
+static void commit (void);
+static void replay (void);
+static void checkpoint (void);
+static void write_header (void);
+
+/* Initializes the journal.  If FORMAT is true, starts with an
+   empty journal.  Otherwise, replays any transaction committed
+   before the last shutdown or crash.  Must be called before
+   anything reads the file system through the buffer cache. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&handles_done);
+  cond_init (&commit_done);
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (format || header.magic != JOURNAL_MAGIC || header.cnt > JOURNAL_MAX)
+    {
+      memset (&header, 0, sizeof header);
+      header.magic = JOURNAL_MAGIC;
+      write_header ();
+    }
+  else if (header.cnt > 0)
+    {
+      printf ("journal: replaying %"PRIu32" sectors\n", header.cnt);
+      replay ();
+    }
+
+  thread_create ("journal", PRI_DEFAULT, commit_thread, NULL);
+}
+
+/* Commits the running transaction and empties the journal. */
+void
+journal_done (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  if (!committing && txn_cnt + order_cnt > 0)
+    commit ();
+  checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  The caller must hold
+   journal_lock and must not be in an operation. */
+static void
+commit (void)
+{
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+  size_t i;
+
+  /* Let operations in progress finish, and keep new ones from
+     starting. */
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&handles_done, &journal_lock);
+
+  /* New data sectors go home before any pointer to them is
+     committed. */
+  for (i = 0; i < order_cnt; i++)
+    cache_write_back (order_sectors[i]);
+  ordered_cnt += order_cnt;
+  order_cnt = 0;
+
+  if (txn_cnt > 0)
+    {
+      /* Free the journal area. */
+      checkpoint ();
+
+      /* Copy the logged sectors into the journal, then commit
+         them. */
+      for (i = 0; i < txn_cnt; i++)
+        {
+          cache_read (txn_sectors[i], buffer);
+          block_write (fs_device, JOURNAL_SECTOR + 1 + i, buffer);
+          header.sectors[i] = txn_sectors[i];
+        }
+      header.seq++;
+      header.cnt = txn_cnt;
+      write_header ();
+
+      /* The sectors can go home now. */
+      for (i = 0; i < txn_cnt; i++)
+        cache_unpin (txn_sectors[i]);
+
+      commit_cnt++;
+      logged_cnt += txn_cnt;
+      committed_op_cnt += op_cnt;
+      txn_cnt = 0;
+      op_cnt = 0;
+    }
+
+  committing = false;
+  cond_broadcast (&commit_done, &journal_lock);
+}
+
+/* Commits the running transaction, if it has logged anything.
+   Must not be called within an operation. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  if (!committing && txn_cnt + order_cnt > 0)
+    commit ();
+  lock_release (&journal_lock);
+}
+
+/* Returns the room left in the running transaction that no
+   operation has claimed.  The caller must hold journal_lock. */
+static size_t
+free_room (void)
+{
+  return JOURNAL_MAX - txn_cnt - order_cnt - reserved_cnt;
+}
+
+/* Starts an operation that changes metadata.  Operations may
+   nest; only the outermost one counts.  Waits for a commit if
+   the running transaction lacks room for JOURNAL_OP_MAX more
+   sectors. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (committing)
+        cond_wait (&commit_done, &journal_lock);
+      else if (free_room () < JOURNAL_OP_MAX)
+        commit ();
+      else
+        break;
+    }
+  t->journal_used = 0;
+  reserved_cnt += JOURNAL_OP_MAX;
+  handle_cnt++;
+  op_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved_cnt -= JOURNAL_OP_MAX - t->journal_used;
+  if (--handle_cnt == 0)
+    cond_broadcast (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Uses up one sector of the current operation's reservation.
+   The caller must hold journal_lock. */
+static void
+use_reservation (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_used < JOURNAL_OP_MAX);
+  t->journal_used++;
+  reserved_cnt--;
+}
+
+/* Returns true if SECTOR is among the CNT sectors in SECTORS. */
+static bool
+contains (const block_sector_t *sectors, size_t cnt, block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (sectors[i] == sector)
+      return true;
+  return false;
+}
+
+/* Adds metadata SECTOR to the running transaction.  Must be
+   called within an operation, before SECTOR is changed in the
+   buffer cache. */
+void
+journal_log (block_sector_t sector)
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (!contains (txn_sectors, txn_cnt, sector))
+    {
+      use_reservation ();
+      cache_pin (sector);
+      txn_sectors[txn_cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Makes the running transaction write data SECTOR, newly
+   allocated by the current operation, to disk before it
+   commits.  Must be called within an operation. */
+void
+journal_order (block_sector_t sector)
+{
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (!contains (order_sectors, order_cnt, sector))
+    {
+      use_reservation ();
+      order_sectors[order_cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld commits of %lld operations, "
+          "%lld sectors journaled, %lld data sectors ordered\n",
+          commit_cnt, committed_op_cnt, logged_cnt, ordered_cnt);
+}
+
+/* Copies committed sector I in the journal to its home
+   location. */
+static void
+copy_home (size_t i)
+{
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+
+  block_read (fs_device, JOURNAL_SECTOR + 1 + i, buffer);
+  block_write (fs_device, header.sectors[i], buffer);
+}
+
+/* Copies every committed sector in the journal to its home
+   location, and marks the journal empty.  Used only at startup,
+   before anything is cached. */
+static void
+replay (void)
+{
+  size_t i;
+
+  for (i = 0; i < header.cnt; i++)
+    copy_home (i);
+  header.cnt = 0;
+  write_header ();
+}
+
+/* Makes sure that every committed sector in the journal has
+   reached its home location, and marks the journal empty.  A
+   cached copy of a committed sector is at least as new as the
+   journal's, so it is written back, unless it is pinned by the
+   running transaction, in which case it has uncommitted changes
+   and the journal's copy goes home instead.  The caller must
+   hold journal_lock. */
+static void
+checkpoint (void)
+{
+  size_t i;
+
+  if (header.cnt == 0)
+    return;
+  for (i = 0; i < header.cnt; i++)
+    if (!cache_write_back (header.sectors[i]))
+      copy_home (i);
+  header.cnt = 0;
+  write_header ();
+}
+
+/* Writes the journal header to disk. */
+static void
+write_header (void)
+{
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Commits the running transaction periodically, so that many
+   operations share each commit. */
+static void
+commit_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_TICKS);
+      journal_commit ();
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 25
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_log (block_sector_t);
+void journal_order (block_sector_t);
+void journal_commit (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -69,6 +69,78 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the number of bits, at most CNT, from bit START up to
+   the end of the element that contains it. */
+static inline size_t
+run_bits (size_t start, size_t cnt) 
+{
+  size_t n = ELEM_BITS - start % ELEM_BITS;
+  return n < cnt ? n : cnt;
+}
+
+/* Returns an elem_type with the CNT bits starting at bit START
+   turned on.  The bits must all fall in one element. */
+static inline elem_type
+run_mask (size_t start, size_t cnt) 
+{
+  elem_type mask = (cnt < ELEM_BITS
+                    ? ((elem_type) 1 << cnt) - 1
+                    : (elem_type) -1);
+  return mask << (start % ELEM_BITS);
+}
+
+/* Returns the number of bits set to 1 in E. */
+static inline size_t
+count_ones (elem_type e) 
+{
+  /* Sum adjacent bits, then nibbles, then bytes in parallel.
+     There is no popcount instruction on the i686. */
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/* Returns the index of the lowest bit set to 1 in E, which must
+   be nonzero.  See the description of the BSF instruction in
+   [IA32-v2a]. */
+static inline size_t
+first_one (elem_type e) 
+{
+  elem_type idx;
+
+  ASSERT (e != 0);
+  asm ("bsfl %1, %0" : "=r" (idx) : "rm" (e) : "cc");
+  return idx;
+}
+
+/* Returns the index of the first bit in B at or after START,
+   and before LIMIT, that is set to VALUE, or LIMIT if there is
+   none.  Elements that contain no such bit are skipped whole. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t limit, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx, last_idx;
+  elem_type e;
+
+  ASSERT (limit <= b->bit_cnt);
+  if (start >= limit)
+    return limit;
+
+  idx = elem_idx (start);
+  last_idx = elem_idx (limit - 1);
+  e = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (e == 0) 
+    {
+      if (++idx > last_idx)
+        return limit;
+      e = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + first_one (e);
+  return start < limit ? start : limit;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -213,18 +285,31 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Whole elements are updated at once; each element is updated
+   atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (cnt > 0) 
+    {
+      size_t n = run_bits (start, cnt);
+      elem_type mask = run_mask (start, n);
+      elem_type *e = &b->bits[elem_idx (start)];
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+
+      start += n;
+      cnt -= n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +317,22 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (cnt > 0) 
+    {
+      size_t n = run_bits (start, cnt);
+      size_t ones = count_ones (b->bits[elem_idx (start)]
+                                & run_mask (start, n));
+      value_cnt += value ? ones : n - ones;
+      start += n;
+      cnt -= n;
+    }
   return value_cnt;
 }
 
@@ -250,15 +341,20 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
+  elem_type flip = value ? 0 : (elem_type) -1;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  while (cnt > 0) 
+    {
+      size_t n = run_bits (start, cnt);
+      if ((b->bits[elem_idx (start)] ^ flip) & run_mask (start, n))
+        return true;
+      start += n;
+      cnt -= n;
+    }
   return false;
 }
 
@@ -291,20 +387,44 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works an element at a time: elements with no bit set to VALUE
+   are skipped whole, and each candidate group is measured by
+   searching for the first bit that is not VALUE. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
-  ASSERT (start <= b->bit_cnt);
+  return bitmap_scan_range (b, start, b->bit_cnt, cnt, value);
+}
 
-  if (cnt <= b->bit_cnt) 
+/* Like bitmap_scan(), but finds only a group that lies entirely
+   before bit END, and does not look at bits from END on. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t end,
+                   size_t cnt, bool value) 
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= end);
+  ASSERT (end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  if (cnt <= end) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t last = end - cnt;
+      while (start <= last) 
+        {
+          size_t first = find_next (b, start, end, value);
+          size_t end;
+          if (first > last)
+            break;
+          end = find_next (b, first, first + cnt, !value);
+          if (end == first + cnt)
+            return first;
+          start = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +478,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes just the bytes of B that contain the CNT bits starting
+   at START to FILE, at the same offsets as bitmap_write() would.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t first, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = start / CHAR_BIT;
+  size = (start + cnt - 1) / CHAR_BIT + 1 - first;
+  return file_write_at (file, (const uint8_t *) b->bits + first,
+                        size, first) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
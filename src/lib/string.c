@@ -1,5 +1,50 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Copies that are shorter than this are done a byte at a time,
+   since aligning and setting up "rep movsl" would cost more than
+   it saves. */
+#define WORD_COPY_MIN 16
+
+/* The string scanning functions below look at 4 bytes at a time
+   once they reach a 4-byte boundary.  An aligned word never
+   crosses a page boundary, so reading the whole word that holds
+   a string's null terminator can't fault even if the rest of
+   the word is past the end of the string. */
+typedef uint32_t word_t __attribute__ ((may_alias));
+#define ONES  0x01010101u       /* 1 in every byte. */
+#define HIGHS 0x80808080u       /* High bit of every byte. */
+
+/* Returns nonzero if any byte in W is zero.  Subtracting 1 from
+   a byte sets its high bit if it was 0 (or above 0x80); masking
+   with ~W rules out the bytes whose high bit was already set. */
+static inline word_t
+has_zero (word_t w) 
+{
+  return (w - ONES) & ~w & HIGHS;
+}
+
+/* Returns nonzero if any byte in W equals the byte replicated
+   through all of PATTERN. */
+static inline word_t
+has_byte (word_t w, word_t pattern) 
+{
+  return has_zero (w ^ pattern);
+}
+
+/* Returns true if P is aligned on a word boundary. */
+static inline bool
+is_aligned (const void *p) 
+{
+  return ((uintptr_t) p & (sizeof (word_t) - 1)) == 0;
+}
+
+static void copy_up (unsigned char *dst, const unsigned char *src,
+                     size_t size);
+static void copy_down (unsigned char *dst, const unsigned char *src,
+                       size_t size);
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,8 +57,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  copy_up (dst, src, size);
 
   return dst_;
 }
@@ -30,19 +74,64 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (src != NULL || size == 0);
 
   if (dst < src) 
+    copy_up (dst, src, size);
+  else 
+    copy_down (dst, src, size);
+
+  return dst_;
+}
+
+/* Copies SIZE bytes from SRC to DST in increasing address order,
+   which is safe even if the blocks overlap as long as DST is not
+   above SRC.  Long copies first align DST to a 4-byte boundary,
+   then move 4 bytes at a time with "rep movsl", then finish off
+   the last few bytes.  See [IA32-v2b] "MOVS" and "REP".  The
+   kernel and the user ABI both guarantee that the direction flag
+   is clear here. */
+static void
+copy_up (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  if (size >= WORD_COPY_MIN) 
     {
-      while (size-- > 0)
-        *dst++ = *src++;
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size = (size - head) & 3;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
     }
-  else 
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
+
+/* Copies SIZE bytes from SRC to DST in decreasing address order,
+   which is safe even if the blocks overlap as long as DST is not
+   below SRC.  Works like copy_up() in reverse, with the direction
+   flag set only for the duration of the copy. */
+static void
+copy_down (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  dst += size;
+  src += size;
+  if (size >= WORD_COPY_MIN) 
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
+      size_t tail = (uintptr_t) dst & 3;
+      size_t words = (size - tail) / 4;
+
+      size = (size - tail) & 3;
+      while (tail-- > 0)
         *--dst = *--src;
+      dst -= 4;
+      src -= 4;
+      asm volatile ("std; rep movsl; cld"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+      dst += 4;
+      src += 4;
     }
-
-  return dst;
+  while (size-- > 0)
+    *--dst = *--src;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +147,13 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip over equal words.  Unaligned loads are fine on x86, and
+     none of them reaches past the end of either block. */
+  for (; size >= sizeof (word_t); a += sizeof (word_t),
+         b += sizeof (word_t), size -= sizeof (word_t))
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -78,6 +174,22 @@ strcmp (const char *a_, const char *b_)
   ASSERT (a != NULL);
   ASSERT (b != NULL);
 
+  while (*a != '\0' && *a == *b && !is_aligned (a)) 
+    {
+      a++;
+      b++;
+    }
+
+  /* If A and B are both aligned, skip over equal words that
+     contain no null terminator. */
+  if (is_aligned (a) && is_aligned (b))
+    while (*(const word_t *) a == *(const word_t *) b
+           && !has_zero (*(const word_t *) a)) 
+      {
+        a += sizeof (word_t);
+        b += sizeof (word_t);
+      }
+
   while (*a != '\0' && *a == *b) 
     {
       a++;
@@ -98,6 +210,16 @@ memchr (const void *block_, int ch_, size_t size)
 
   ASSERT (block != NULL || size == 0);
 
+  for (; size > 0 && !is_aligned (block); size--, block++)
+    if (*block == ch)
+      return (void *) block;
+
+  /* Skip over words that don't contain CH. */
+  for (; size >= sizeof (word_t); size -= sizeof (word_t),
+         block += sizeof (word_t))
+    if (has_byte (*(const word_t *) block, ch * ONES))
+      break;
+
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -116,6 +238,24 @@ strchr (const char *string, int c_)
 
   ASSERT (string != NULL);
 
+  for (;;) 
+    if (*string == c)
+      return (char *) string;
+    else if (*string == '\0')
+      return NULL;
+    else if (is_aligned (++string))
+      break;
+
+  /* Skip over words that contain neither C nor a null
+     terminator, then finish up a byte at a time. */
+  for (;;) 
+    {
+      word_t w = *(const word_t *) string;
+      if (has_zero (w) || has_byte (w, (unsigned char) c * ONES))
+        break;
+      string += sizeof (word_t);
+    }
+
   for (;;) 
     if (*string == c)
       return (char *) string;
@@ -274,16 +414,29 @@ strtok_r (char *s, const char *delimiters, char **save_ptr)
   return token;
 }
 
-/* Sets the SIZE bytes in DST to VALUE. */
+/* Sets the SIZE bytes in DST to VALUE.  Long blocks are filled
+   4 bytes at a time with "rep stosl", as in copy_up(). */
 void *
 memset (void *dst_, int value, size_t size) 
 {
   unsigned char *dst = dst_;
+  uint32_t word = (unsigned char) value * 0x01010101u;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  if (size >= WORD_COPY_MIN) 
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size = (size - head) & 3;
+      asm volatile ("rep stosb"
+                    : "+D" (dst), "+c" (head) : "a" (word) : "memory");
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+    }
+  asm volatile ("rep stosb"
+                : "+D" (dst), "+c" (size) : "a" (word) : "memory");
 
   return dst_;
 }
@@ -296,7 +449,15 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (p = string; !is_aligned (p); p++)
+    if (*p == '\0')
+      return p - string;
+
+  /* Skip over words without a null terminator. */
+  while (!has_zero (*(const word_t *) p))
+    p += sizeof (word_t);
+
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -308,9 +469,20 @@ strnlen (const char *string, size_t maxlen)
 {
   size_t length;
 
-  for (length = 0; string[length] != '\0' && length < maxlen; length++)
+  for (length = 0; length < maxlen && !is_aligned (string + length);
+       length++)
+    if (string[length] == '\0')
+      return length;
+
+  /* Skip over words without a null terminator.  The last word
+     may extend past MAXLEN, which is harmless because it is
+     aligned. */
+  while (length < maxlen && !has_zero (*(const word_t *) (string + length)))
+    length += sizeof (word_t);
+
+  for (; length < maxlen && string[length] != '\0'; length++)
     continue;
-  return length;
+  return length < maxlen ? length : maxlen;
 }
 
 /* Copies string SRC to DST.  If SRC is longer than SIZE - 1
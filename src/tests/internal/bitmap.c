@@ -0,0 +1,155 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), bitmap_contains(), and
+   bitmap_set_multiple() against straightforward bit-at-a-time
+   versions on random bitmaps, then times single-bit and
+   multi-bit scans of a 1M-bit map with both.  Times are in timer
+   ticks, so only large differences show up.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Maximum number of bits in a bitmap that we will test. */
+#define MAX_BITS 256
+
+/* Number of bits in the bitmap used for timing. */
+#define BENCH_BITS (1024 * 1024)
+
+/* Number of times each timed scan is repeated. */
+#define BENCH_REPEAT 16
+
+static void randomize (struct bitmap *, int density);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static void bench (struct bitmap *, size_t cnt);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  struct bitmap *b;
+  size_t bit_cnt;
+
+  printf ("testing various size bitmaps:");
+  for (bit_cnt = 0; bit_cnt < MAX_BITS; bit_cnt = bit_cnt * 3 / 2 + 1)
+    {
+      int repeat;
+
+      printf (" %zu", bit_cnt);
+      b = bitmap_create (bit_cnt);
+      ASSERT (b != NULL);
+      for (repeat = 0; repeat < 100; repeat++)
+        {
+          size_t start = random_ulong () % (bit_cnt + 1);
+          size_t cnt = random_ulong () % (bit_cnt - start + 1);
+          bool value = random_ulong () % 2;
+          size_t i;
+
+          randomize (b, random_ulong () % 101);
+          ASSERT (bitmap_scan (b, start, cnt % 12, value)
+                  == slow_scan (b, start, cnt % 12, value));
+          ASSERT (bitmap_scan (b, start, cnt, value)
+                  == slow_scan (b, start, cnt, value));
+          ASSERT (bitmap_count (b, start, cnt, value)
+                  == slow_count (b, start, cnt, value));
+          ASSERT (bitmap_contains (b, start, cnt, value)
+                  == (slow_count (b, start, cnt, value) > 0));
+
+          bitmap_set_multiple (b, start, cnt, value);
+          for (i = 0; i < cnt; i++)
+            ASSERT (bitmap_test (b, start + i) == value);
+        }
+      bitmap_destroy (b);
+    }
+  printf (" done\n");
+
+  /* A nearly full map with scattered single free bits and one
+     free run at the very end, roughly what a busy page or
+     sector allocator looks like. */
+  b = bitmap_create (BENCH_BITS);
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  for (bit_cnt = 0; bit_cnt < BENCH_BITS; bit_cnt += 4099)
+    bitmap_reset (b, bit_cnt);
+  bitmap_set_multiple (b, BENCH_BITS - 64, 64, false);
+  bench (b, 1);
+  bench (b, 8);
+  bench (b, 64);
+  bitmap_destroy (b);
+
+  printf ("bitmap: PASS\n");
+}
+
+/* Sets each bit in B to true with probability DENSITY percent. */
+static void
+randomize (struct bitmap *b, int density)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < density);
+}
+
+/* Bit-at-a-time equivalent of bitmap_scan(). */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  if (cnt > bitmap_size (b))
+    return BITMAP_ERROR;
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    if (slow_count (b, i, cnt, value) == cnt)
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Bit-at-a-time equivalent of bitmap_count(). */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Times scanning B for CNT consecutive false bits, both with
+   bitmap_scan() and with slow_scan(), and prints the results. */
+static void
+bench (struct bitmap *b, size_t cnt)
+{
+  int64_t start;
+  int64_t fast, slow;
+  size_t fast_idx = 0, slow_idx = 0;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_REPEAT; i++)
+    fast_idx = bitmap_scan (b, 0, cnt, false);
+  fast = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_REPEAT; i++)
+    slow_idx = slow_scan (b, 0, cnt, false);
+  slow = timer_elapsed (start);
+
+  ASSERT (fast_idx == slow_idx);
+  printf ("scan for %zu free bit(s) in %d bits, %d times: "
+          "%"PRId64" ticks word-at-a-time, %"PRId64" ticks bit-at-a-time\n",
+          cnt, BENCH_BITS, BENCH_REPEAT, fast, slow);
+}
@@ -0,0 +1,62 @@
+/* Benchmark for address-space switches.
+
+   Alternates between two process page directories, as happens
+   when the scheduler switches between two user processes, and
+   after each switch touches a spread of kernel pages the way a
+   system call or interrupt handler would.  Run it once normally
+   and once with the -nopge kernel option to see what keeping the
+   kernel's TLB entries global across CR3 reloads saves (see
+   paging_init() in threads/init.c).
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Number of switches between the two page directories. */
+#define SWITCH_CNT 100000
+
+/* Number of kernel pages touched after each switch. */
+#define TOUCH_PAGES 64
+
+void
+test (void)
+{
+  volatile uint32_t sum = 0;
+  uint32_t *pd[2];
+  size_t stride = init_ram_pages / TOUCH_PAGES;
+  int64_t start, ticks;
+  int i, j;
+
+  pd[0] = pagedir_create ();
+  pd[1] = pagedir_create ();
+  ASSERT (pd[0] != NULL && pd[1] != NULL);
+
+  start = timer_ticks ();
+  for (i = 0; i < SWITCH_CNT; i++)
+    {
+      pagedir_activate (pd[i % 2]);
+      for (j = 0; j < TOUCH_PAGES; j++)
+        sum += *(uint32_t *) ptov ((uintptr_t) j * stride * PGSIZE);
+    }
+  ticks = timer_elapsed (start);
+  pagedir_activate (NULL);
+
+  printf ("%d address space switches, %d kernel pages touched "
+          "after each: %"PRId64" ticks\n", SWITCH_CNT, TOUCH_PAGES, ticks);
+
+  pagedir_destroy (pd[0]);
+  pagedir_destroy (pd[1]);
+
+  printf ("ctxswitch: PASS\n");
+}
@@ -0,0 +1,81 @@
+/* Test for directories on a file system that uses the extent
+   inode format.
+
+   Creates NAME_CNT files, each with a sector of data, in a new
+   directory as if the kernel had been given -extents, then
+   checks that every one can be found and removed.  Buckets fill
+   in hash order, so this fails if the directory's own inode is
+   in the extent format, which runs out of extents after a few
+   dozen names.  Run it on a freshly formatted file system with at
+   least 512 kB free.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/test.h"
+
+/* Number of files added to the directory. */
+#define NAME_CNT 300
+
+void
+test (void)
+{
+  block_sector_t dir_sector;
+  char name[NAME_MAX + 1];
+  struct inode *inode;
+  struct dir *dir;
+  bool old_use_extents = inode_use_extents;
+  int i;
+
+  inode_use_extents = true;
+  ASSERT (free_map_allocate (1, &dir_sector));
+  ASSERT (dir_create (dir_sector, 0));
+  dir = dir_open (inode_open (dir_sector));
+  ASSERT (dir != NULL);
+
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      block_sector_t sector;
+
+      snprintf (name, sizeof name, "file%d", i);
+      ASSERT (free_map_allocate (1, &sector));
+      ASSERT (inode_create (sector, 0));
+      inode = inode_open (sector);
+      ASSERT (inode_write_at (inode, name, sizeof name, 0) == sizeof name);
+      inode_close (inode);
+      ASSERT (dir_add (dir, name, sector));
+    }
+
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      char data[NAME_MAX + 1];
+
+      snprintf (name, sizeof name, "file%d", i);
+      ASSERT (dir_lookup (dir, name, &inode));
+      ASSERT (inode_read_at (inode, data, sizeof data, 0) == sizeof data);
+      ASSERT (!strcmp (data, name));
+      inode_close (inode);
+    }
+
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      ASSERT (dir_remove (dir, name));
+      ASSERT (!dir_lookup (dir, name, &inode));
+    }
+  ASSERT (!dir_readdir (dir, name));
+
+  inode_remove (dir_get_inode (dir));
+  dir_close (dir);
+  inode_use_extents = old_use_extents;
+
+  printf ("dirextents: PASS\n");
+}
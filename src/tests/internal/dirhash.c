@@ -0,0 +1,90 @@
+/* Benchmark for directory lookups.
+
+   Adds NAME_CNT names to a new directory, then looks each of
+   them up, along with as many names that are not there, and
+   finally lists the directory, timing each phase.  Run it on a
+   freshly formatted file system with at least 1 MB free.
+
+   Every entry refers to the same empty file, so that the
+   benchmark needs only a few hundred sectors of disk.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/test.h"
+
+/* Number of names added to the directory. */
+#define NAME_CNT 10000
+
+void
+test (void)
+{
+  block_sector_t dir_sector, file_sector;
+  char name[NAME_MAX + 1];
+  struct inode *inode;
+  struct dir *dir;
+  int64_t start;
+  int i;
+
+  ASSERT (free_map_allocate (1, &dir_sector));
+  ASSERT (free_map_allocate (1, &file_sector));
+  ASSERT (dir_create (dir_sector, 0));
+  ASSERT (inode_create (file_sector, 0));
+  dir = dir_open (inode_open (dir_sector));
+  ASSERT (dir != NULL);
+
+  start = timer_ticks ();
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      ASSERT (dir_add (dir, name, file_sector));
+    }
+  printf ("add %d names: %"PRId64" ticks\n",
+          NAME_CNT, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      ASSERT (dir_lookup (dir, name, &inode));
+      ASSERT (inode_get_inumber (inode) == file_sector);
+      inode_close (inode);
+    }
+  printf ("look up %d names: %"PRId64" ticks\n",
+          NAME_CNT, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      snprintf (name, sizeof name, "missing%d", i);
+      ASSERT (!dir_lookup (dir, name, &inode));
+    }
+  printf ("look up %d missing names: %"PRId64" ticks\n",
+          NAME_CNT, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; dir_readdir (dir, name); i++)
+    continue;
+  ASSERT (i == NAME_CNT);
+  printf ("list %d names: %"PRId64" ticks\n",
+          NAME_CNT, timer_elapsed (start));
+
+  /* Delete the directory and the file without removing each
+     entry, since they all refer to the same file. */
+  inode_remove (dir_get_inode (dir));
+  dir_close (dir);
+  inode = inode_open (file_sector);
+  inode_remove (inode);
+  inode_close (inode);
+
+  printf ("dirhash: PASS\n");
+}
@@ -0,0 +1,291 @@
+/* Test program for lib/string.c.
+
+   Checks memcpy(), memmove(), and memset() against byte-at-a-time
+   versions for many sizes and alignments, then times each of
+   them against its byte-at-a-time version for block sizes from
+   8 bytes to 64 kB.
+
+   Also fuzzes the word-at-a-time scanning functions, strlen(),
+   strnlen(), memchr(), strchr(), memcmp(), and strcmp(), against
+   byte-at-a-time versions on random strings at random
+   alignments.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Size of the buffers used for checking. */
+#define CHECK_SIZE 512
+
+/* Number of random cases for the scanning functions. */
+#define FUZZ_CNT 100000
+
+/* Largest block size timed, and the number of bytes moved for
+   each block size timed. */
+#define BENCH_MAX (64 * 1024)
+#define BENCH_BYTES (16 * 1024 * 1024)
+
+static void check_mem (void);
+static void check_scan (void);
+static void bench_mem (void);
+static void slow_memcpy (void *, const void *, size_t);
+static void slow_memset (void *, int, size_t);
+static size_t slow_strnlen (const char *, size_t);
+static const void *slow_memchr (const void *, int, size_t);
+static int slow_memcmp (const void *, const void *, size_t);
+static int sign (int);
+
+void
+test (void)
+{
+  check_mem ();
+  check_scan ();
+  bench_mem ();
+  printf ("string: PASS\n");
+}
+
+/* Fills the SIZE bytes at P with random data. */
+static void
+randomize (void *p_, size_t size)
+{
+  uint8_t *p = p_;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = random_ulong ();
+}
+
+/* Compares memcpy(), memmove(), and memset() with the slow
+   versions for every small size and all relative alignments. */
+static void
+check_mem (void)
+{
+  static uint8_t a[CHECK_SIZE], b[CHECK_SIZE], ref[CHECK_SIZE];
+  size_t size;
+
+  printf ("checking memcpy, memmove, memset:");
+  for (size = 0; size < CHECK_SIZE / 2;
+       size = size < 40 ? size + 1 : size * 2)
+    {
+      size_t src_ofs, dst_ofs;
+
+      printf (" %zu", size);
+      for (src_ofs = 0; src_ofs < 8; src_ofs++)
+        for (dst_ofs = 0; dst_ofs < 8; dst_ofs++)
+          {
+            int value = random_ulong ();
+
+            randomize (a, sizeof a);
+            randomize (b, sizeof b);
+            memcpy (ref, b, sizeof b);
+            ASSERT (memcpy (b + dst_ofs, a + src_ofs, size) == b + dst_ofs);
+            slow_memcpy (ref + dst_ofs, a + src_ofs, size);
+            ASSERT (!memcmp (b, ref, sizeof b));
+
+            /* Overlapping moves in both directions. */
+            ASSERT (memmove (b + dst_ofs, b + src_ofs, size)
+                    == b + dst_ofs);
+            memcpy (a, ref + src_ofs, size);
+            slow_memcpy (ref + dst_ofs, a, size);
+            ASSERT (!memcmp (b, ref, sizeof b));
+
+            ASSERT (memset (b + dst_ofs, value, size) == b + dst_ofs);
+            slow_memset (ref + dst_ofs, value, size);
+            ASSERT (!memcmp (b, ref, sizeof b));
+          }
+    }
+  printf (" done\n");
+}
+
+/* Fills the SIZE bytes at P with a random string drawn from a
+   small alphabet, so that matches and early null terminators
+   are common, and null-terminates it. */
+static void
+random_string (char *p, size_t size)
+{
+  size_t zero_odds = random_ulong () % 16 + 2;
+  size_t i;
+
+  for (i = 0; i + 1 < size; i++)
+    if (random_ulong () % zero_odds == 0)
+      p[i] = '\0';
+    else if (random_ulong () % 8 == 0)
+      p[i] = random_ulong ();
+    else
+      p[i] = 'a' + random_ulong () % 3;
+  p[size - 1] = '\0';
+}
+
+/* Compares the word-at-a-time scanning functions with the slow
+   versions on random strings at random alignments. */
+static void
+check_scan (void)
+{
+  static char a[CHECK_SIZE], b[CHECK_SIZE];
+  int i;
+
+  printf ("checking strlen, strnlen, memchr, strchr, memcmp, strcmp:");
+  for (i = 0; i < FUZZ_CNT; i++)
+    {
+      size_t a_ofs = random_ulong () % 16;
+      size_t b_ofs = random_ulong () % 2 ? a_ofs : random_ulong () % 16;
+      size_t size = random_ulong () % (CHECK_SIZE / 2);
+      int ch = random_ulong () % 4 ? 'a' + random_ulong () % 3
+                                   : (int) (random_ulong () % 256);
+      int changes;
+
+      /* B is a copy of A with a few bytes changed. */
+      random_string (a, sizeof a);
+      memcpy (b, a, sizeof b);
+      for (changes = random_ulong () % 3; changes > 0; changes--)
+        b[random_ulong () % (sizeof b - 1)] = 'a' + random_ulong () % 3;
+
+      ASSERT (strlen (a + a_ofs) == slow_strnlen (a + a_ofs, SIZE_MAX));
+      ASSERT (strnlen (a + a_ofs, size) == slow_strnlen (a + a_ofs, size));
+      ASSERT (memchr (a + a_ofs, ch, size)
+              == slow_memchr (a + a_ofs, ch, size));
+      ASSERT (strchr (a + a_ofs, ch)
+              == slow_memchr (a + a_ofs, ch,
+                              slow_strnlen (a + a_ofs, SIZE_MAX) + 1));
+      ASSERT (sign (memcmp (a + a_ofs, b + b_ofs, size))
+              == slow_memcmp (a + a_ofs, b + b_ofs, size));
+      ASSERT (sign (strcmp (a + a_ofs, b + b_ofs))
+              == slow_memcmp (a + a_ofs, b + b_ofs,
+                              slow_strnlen (a + a_ofs, SIZE_MAX) + 1));
+
+      if (i % (FUZZ_CNT / 10) == 0)
+        printf (" %d", i);
+    }
+  printf (" done\n");
+}
+
+/* Times memcpy(), memmove(), and memset() and their slow
+   versions for block sizes from 8 bytes to BENCH_MAX bytes. */
+static void
+bench_mem (void)
+{
+  size_t pages = 2 * BENCH_MAX / PGSIZE;
+  uint8_t *src = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, pages);
+  uint8_t *dst = src + BENCH_MAX;
+  size_t size;
+
+  printf ("%8s %10s %10s %10s %10s %10s\n", "bytes",
+          "memcpy", "slow", "memmove", "memset", "slow");
+  for (size = 8; size <= BENCH_MAX; size *= 2)
+    {
+      size_t cnt = BENCH_BYTES / size;
+      int64_t ticks[5];
+      int64_t start;
+      size_t i;
+
+      start = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        memcpy (dst, src, size);
+      ticks[0] = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        slow_memcpy (dst, src, size);
+      ticks[1] = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        memmove (src + 1, src, size);
+      ticks[2] = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        memset (dst, i, size);
+      ticks[3] = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (i = 0; i < cnt; i++)
+        slow_memset (dst, i, size);
+      ticks[4] = timer_elapsed (start);
+
+      printf ("%8zu %10"PRId64" %10"PRId64" %10"PRId64" %10"PRId64
+              " %10"PRId64"\n",
+              size, ticks[0], ticks[1], ticks[2], ticks[3], ticks[4]);
+    }
+  printf ("(timer ticks to move %d MB at each size)\n",
+          BENCH_BYTES / 1024 / 1024);
+
+  palloc_free_multiple (src, pages);
+}
+
+/* Byte-at-a-time memcpy(). */
+static void
+slow_memcpy (void *dst_, const void *src_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+/* Byte-at-a-time memset(). */
+static void
+slow_memset (void *dst_, int value, size_t size)
+{
+  uint8_t *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+/* Byte-at-a-time strnlen(). */
+static size_t
+slow_strnlen (const char *string, size_t maxlen)
+{
+  size_t length;
+
+  for (length = 0; length < maxlen && string[length] != '\0'; length++)
+    continue;
+  return length;
+}
+
+/* Byte-at-a-time memchr(). */
+static const void *
+slow_memchr (const void *block_, int ch, size_t size)
+{
+  const unsigned char *block = block_;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (block[i] == (unsigned char) ch)
+      return block + i;
+  return NULL;
+}
+
+/* Byte-at-a-time memcmp(), normalized to -1, 0, or +1. */
+static int
+slow_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (a[i] != b[i])
+      return a[i] > b[i] ? +1 : -1;
+  return 0;
+}
+
+/* Returns -1, 0, or +1 according to the sign of X. */
+static int
+sign (int x)
+{
+  return x < 0 ? -1 : x > 0;
+}
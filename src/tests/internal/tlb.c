@@ -0,0 +1,66 @@
+/* Benchmark for the kernel's mapping of physical memory.
+
+   Times two TLB-miss-heavy workloads that run entirely in the
+   kernel: reading one word from every page of RAM, and memcpy()
+   between two large buffers.  Run it once normally and once with
+   the -nopse kernel option to compare 4 MB and 4 kB kernel
+   mappings (see paging_init() in threads/init.c).
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Number of passes over RAM in the page-stride test. */
+#define STRIDE_PASSES 64
+
+/* Size of each memcpy() buffer, in pages, and number of copies. */
+#define COPY_PAGES 256
+#define COPY_PASSES 64
+
+void
+test (void)
+{
+  volatile uint32_t sum = 0;
+  uint8_t *src, *dst;
+  int64_t start, ticks;
+  size_t page;
+  int pass;
+
+  /* Touch one word per page, so that nearly every access needs a
+     different translation. */
+  start = timer_ticks ();
+  for (pass = 0; pass < STRIDE_PASSES; pass++)
+    for (page = 0; page < init_ram_pages; page++)
+      sum += *(uint32_t *) ptov (page * PGSIZE);
+  ticks = timer_elapsed (start);
+  printf ("page-stride reads over %"PRIu32" pages, %d passes: "
+          "%"PRId64" ticks\n", init_ram_pages, STRIDE_PASSES, ticks);
+
+  /* Large copies. */
+  src = palloc_get_multiple (PAL_ASSERT, COPY_PAGES);
+  dst = palloc_get_multiple (PAL_ASSERT, COPY_PAGES);
+  memset (src, 0x5a, COPY_PAGES * PGSIZE);
+  start = timer_ticks ();
+  for (pass = 0; pass < COPY_PASSES; pass++)
+    memcpy (dst, src, COPY_PAGES * PGSIZE);
+  ticks = timer_elapsed (start);
+  ASSERT (!memcmp (dst, src, COPY_PAGES * PGSIZE));
+  printf ("memcpy of %d kB, %d passes: %"PRId64" ticks\n",
+          COPY_PAGES * PGSIZE / 1024, COPY_PASSES, ticks);
+  palloc_free_multiple (src, COPY_PAGES);
+  palloc_free_multiple (dst, COPY_PAGES);
+
+  printf ("tlb: PASS\n");
+}
@@ -36,7 +36,24 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+#endif
+
+/* Flags in control register 4.  See [IA32-v3a] 2.5 "Control
+   Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extensions (4 MB pages). */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
+/* Feature flags returned in EDX by CPUID with EAX=1.  See
+   [IA32-v2a] "CPUID--CPU Identification". */
+#define CPUID_EDX_PSE 0x00000008 /* 4 MB pages supported. */
+#define CPUID_EDX_PGE 0x00002000 /* Global pages supported. */
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -57,8 +74,15 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -nopse: Map kernel memory with 4 kB pages only? */
+static bool no_large_pages;
+
+/* -nopge: Leave kernel mappings non-global? */
+static bool no_global_pages;
+
 static void bss_init (void);
 static void paging_init (void);
+static uint32_t cpu_features (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -127,6 +151,13 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  share_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -153,17 +184,44 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, each 4 MB region of physical
+   memory is mapped with a single large-page PDE, which saves a
+   page table per region and lets one TLB entry cover it.  The
+   region that contains the kernel's text, which is mapped
+   read-only, and any partial region at the end of RAM still use
+   4 kB pages.  What this saves in TLB misses has not been
+   measured; tests/internal/tlb.c, run with and without -nopse,
+   is the harness for doing so.
+
+   If the CPU supports global pages, all of these mappings are
+   marked global.  The kernel mapping is the same in every page
+   directory, so its TLB entries then survive the CR3 reloads in
+   pagedir_activate(), and switching processes only flushes user
+   translations.  This too is unmeasured; running
+   tests/internal/ctxswitch.c with and without -nopge would show
+   what it saves. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  bool large_pages = !no_large_pages && (features & CPUID_EDX_PSE);
+  uint32_t global = (!no_global_pages && (features & CPUID_EDX_PGE)
+                     ? PTE_G : 0);
+  uint32_t cr4;
+
+  /* Enable 4 MB pages. */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (large_pages)
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
-  for (page = 0; page < init_ram_pages; page++)
+  for (page = 0; page < init_ram_pages; )
     {
       uintptr_t paddr = page * PGSIZE;
       char *vaddr = ptov (paddr);
@@ -171,13 +229,23 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large_pages && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large_kernel (vaddr, true) | global;
+          page += PTSPAN / PGSIZE;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
+      page++;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -186,6 +254,27 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Enable global pages, now that only the kernel mapping, which
+     never changes, is marked global.  See [IA32-v3a] 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  if (global)
+    {
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
+    }
+}
+
+/* Returns the CPU's feature flags (CPUID_EDX_*). */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return edx;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -247,6 +336,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -256,9 +347,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-nopse"))
+        no_large_pages = true;
+      else if (!strcmp (name, "-nopge"))
+        no_global_pages = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        page_stack_limit = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -373,14 +472,20 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -extents           Create files with extent-based inodes.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -nopse             Map kernel memory with 4 kB pages only.\n"
+          "  -nopge             Don't make kernel TLB entries global.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
 #endif
           );
   shutdown_power_off ();
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,22 +24,68 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   The split is only a starting point.  When a pool runs low on
+   free pages it borrows a contiguous run of free pages from the
+   other pool, as long as the lender keeps at least its reserve
+   free.  Either pool can borrow pages back the same way later.
+   To make that cheap, both pools' bitmaps cover all of free
+   memory, with the pages a pool does not own marked as in use,
+   and owner_map records which pool owns each page.
+
+   Free pages that the idle thread has already filled with zeros
+   are remembered in each pool's zeroed_map, so that PAL_ZERO
+   requests can usually skip the memset. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    struct bitmap *zeroed_map;          /* Free pages known to be zero. */
+    size_t zeroed_cnt;                  /* Number of bits set in zeroed_map. */
+    size_t zero_cursor;                 /* Where the idle zeroer resumes. */
+    size_t zero_pending;                /* Zeroed, not yet freed, or
+                                           BITMAP_ERROR. */
+    const char *name;                   /* Name, for statistics. */
+
+    /* Balancing between pools.
+       free_cnt is also updated by palloc_free_multiple(), which
+       cannot take LOCK, so it is only changed with interrupts
+       off. */
+    size_t page_cnt;                    /* Pages owned by this pool. */
+    size_t free_cnt;                    /* Owned pages that are free. */
+    size_t max_pages;                   /* Never own more than this. */
+    size_t reserve;                     /* Never lend below this many free. */
+    size_t borrowed_cnt;                /* Pages borrowed, in total. */
+    size_t lent_cnt;                    /* Pages lent, in total. */
+    size_t loan_cnt;                    /* Number of borrowing operations. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* Free memory shared by both pools. */
+static uint8_t *pool_base;              /* First page. */
+static size_t pool_page_cnt;            /* Number of pages. */
+static struct bitmap *owner_map;        /* Pages owned by the user pool. */
+
+/* A pool with fewer than this many free pages tries to borrow
+   from the other pool. */
+#define LOW_WATER_PAGES 16
+
+/* Number of pages borrowed at a time, if available. */
+#define LOAN_PAGES 64
+
+static void init_pool (struct pool *, size_t first_page, size_t page_cnt,
+                       size_t max_pages, const char *name);
+static struct pool *page_owner (void *page);
+static bool borrow_pages (struct pool *, size_t page_cnt);
+static void adjust_free_cnt (struct pool *, size_t add, size_t sub);
+static size_t take_zeroed (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t find_unzeroed (struct pool *, size_t start);
+static bool zero_free_page (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -49,16 +96,41 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
-  if (user_pages > user_page_limit)
-    user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  size_t user_pages, kernel_pages;
+  size_t bm_size, bm_pages;
+  uint8_t *bm;
+
+  /* We'll put the five bitmaps, each with one bit per page of
+     free memory, at its base.  Calculate the space needed for
+     them and subtract it from free memory. */
+  bm_size = bitmap_buf_size (free_pages);
+  bm_pages = DIV_ROUND_UP (5 * bm_size, PGSIZE);
+  if (bm_pages > free_pages)
+    PANIC ("Not enough memory for page allocator bitmaps.");
+  pool_base = free_start + bm_pages * PGSIZE;
+  pool_page_cnt = free_pages - bm_pages;
+
+  bm = free_start;
+  owner_map = bitmap_create_in_buf (pool_page_cnt, bm, bm_size);
+  kernel_pool.used_map = bitmap_create_in_buf (pool_page_cnt,
+                                               bm + bm_size, bm_size);
+  kernel_pool.zeroed_map = bitmap_create_in_buf (pool_page_cnt,
+                                                 bm + 2 * bm_size, bm_size);
+  user_pool.used_map = bitmap_create_in_buf (pool_page_cnt,
+                                             bm + 3 * bm_size, bm_size);
+  user_pool.zeroed_map = bitmap_create_in_buf (pool_page_cnt,
+                                               bm + 4 * bm_size, bm_size);
 
   /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  user_pages = free_pages / 2;
+  if (user_pages > user_page_limit)
+    user_pages = user_page_limit;
+  if (user_pages > pool_page_cnt)
+    user_pages = pool_page_cnt;
+  kernel_pages = pool_page_cnt - user_pages;
+  init_pool (&kernel_pool, 0, kernel_pages, pool_page_cnt, "kernel pool");
+  init_pool (&user_pool, kernel_pages, user_pages,
+             user_page_limit, "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -66,29 +138,71 @@ palloc_init (size_t user_page_limit)
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.  If PAL_NOBORROW is
+   set, only pages already in the pool are used, for speculative
+   requests that must not take memory from the other pool. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  size_t zeroed_cnt = 0;
+  bool retried = false;
 
   if (page_cnt == 0)
     return NULL;
 
+ retry:
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_cnt == 1 && pool->zeroed_cnt > 0)
+    {
+      /* Hand out a page that the idle thread already zeroed if
+         the caller wants zeros, and otherwise one that it has
+         not zeroed, to save the zeroed pages for PAL_ZERO. */
+      if (flags & PAL_ZERO)
+        page_idx = bitmap_scan (pool->zeroed_map, 0, 1, true);
+      else
+        {
+          page_idx = find_unzeroed (pool, 0);
+          if (page_idx == BITMAP_ERROR)
+            page_idx = bitmap_scan (pool->used_map, 0, 1, false);
+        }
+      ASSERT (page_idx != BITMAP_ERROR);
+      bitmap_mark (pool->used_map, page_idx);
+    }
+  else
+    page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    {
+      zeroed_cnt = take_zeroed (pool, page_idx, page_cnt);
+      adjust_free_cnt (pool, 0, page_cnt);
+    }
   lock_release (&pool->lock);
 
+  /* Under pressure, borrow from the other pool: enough to retry a
+     failed request, or a batch ahead of time if we are merely
+     running low.  PAL_NOBORROW rules out both. */
+  if (page_idx == BITMAP_ERROR)
+    {
+      if (!retried && !(flags & PAL_NOBORROW)
+          && borrow_pages (pool, page_cnt))
+        {
+          retried = true;
+          goto retry;
+        }
+    }
+  else if (pool->free_cnt < LOW_WATER_PAGES && !(flags & PAL_NOBORROW))
+    borrow_pages (pool, LOAN_PAGES);
+
   if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+    pages = pool_base + PGSIZE * page_idx;
   else
     pages = NULL;
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && zeroed_cnt < page_cnt)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -124,14 +238,8 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  pool = page_owner (pages);
+  page_idx = pg_no (pages) - pg_no (pool_base);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
@@ -139,6 +247,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  adjust_free_cnt (pool, page_cnt, 0);
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +257,236 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
-static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+/* Zeroes one free page that is not already known to be zero,
+   so that a later PAL_ZERO request can skip the memset.  Called
+   by the idle thread, which must never block, so a busy pool is
+   simply skipped.  Returns true if a page was zeroed, false if
+   there was nothing to do. */
+bool
+palloc_zero_idle_page (void)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  return zero_free_page (&kernel_pool) || zero_free_page (&user_pool);
+}
+
+/* Prints statistics about pool balancing. */
+void
+palloc_print_stats (void)
+{
+  struct pool *pools[] = { &kernel_pool, &user_pool };
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      struct pool *p = pools[i];
+      printf ("Palloc: %s: %zu of %zu pages free, "
+              "%zu borrowed in %zu loans, %zu lent\n",
+              p->name, p->free_cnt, p->page_cnt,
+              p->borrowed_cnt, p->loan_cnt, p->lent_cnt);
+    }
+}
 
+/* Initializes pool P as owning the PAGE_CNT pages starting at
+   page FIRST_PAGE of free memory, allowing it to grow to at most
+   MAX_PAGES pages, and naming it NAME for debugging purposes.
+   The pool's bitmaps must already have been created. */
+static void
+init_pool (struct pool *p, size_t first_page, size_t page_cnt,
+           size_t max_pages, const char *name) 
+{
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  bitmap_set_all (p->used_map, true);
+  bitmap_set_multiple (p->used_map, first_page, page_cnt, false);
+  bitmap_set_all (p->zeroed_map, false);
+  bitmap_set_multiple (owner_map, first_page, page_cnt, p == &user_pool);
+  p->zeroed_cnt = 0;
+  p->zero_cursor = 0;
+  p->zero_pending = BITMAP_ERROR;
+  p->name = name;
+  p->page_cnt = page_cnt;
+  p->free_cnt = page_cnt;
+  p->max_pages = max_pages;
+  p->reserve = page_cnt / 4;
+  p->borrowed_cnt = p->lent_cnt = p->loan_cnt = 0;
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
-static bool
-page_from_pool (const struct pool *pool, void *page) 
+/* Returns the pool that owns PAGE, which must be in free
+   memory. */
+static struct pool *
+page_owner (void *page) 
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (pool_base);
+
+  ASSERT (page_no >= start_page && page_no < start_page + pool_page_cnt);
+  return (bitmap_test (owner_map, page_no - start_page)
+          ? &user_pool : &kernel_pool);
+}
 
-  return page_no >= start_page && page_no < end_page;
+/* Moves a run of free pages from the other pool to pool TO.
+   Tries to move LOAN_PAGES pages, but settles for PAGE_CNT.
+   The lender always keeps at least its reserve of free pages.
+   Returns true if any pages were moved. */
+static bool
+borrow_pages (struct pool *to, size_t page_cnt) 
+{
+  struct pool *from = to == &user_pool ? &kernel_pool : &user_pool;
+  size_t page_idx = BITMAP_ERROR;
+  size_t cnt = page_cnt > LOAN_PAGES ? page_cnt : LOAN_PAGES;
+
+  /* Take the pages out of the lender.  Only one pool lock is
+     ever held at a time, so there is no lock ordering to get
+     wrong. */
+  lock_acquire (&from->lock);
+  for (;;)
+    {
+      if (to->page_cnt + cnt <= to->max_pages
+          && from->free_cnt >= from->reserve + cnt)
+        page_idx = bitmap_scan_and_flip (from->used_map, 0, cnt, false);
+      if (page_idx != BITMAP_ERROR || cnt == page_cnt)
+        break;
+      cnt = page_cnt;
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      take_zeroed (from, page_idx, cnt);
+      adjust_free_cnt (from, 0, cnt);
+      from->page_cnt -= cnt;
+      from->lent_cnt += cnt;
+    }
+  lock_release (&from->lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* The pages are now marked in use in both pools, so nobody can
+     allocate or free them while ownership changes hands. */
+  bitmap_set_multiple (owner_map, page_idx, cnt, to == &user_pool);
+  lock_acquire (&to->lock);
+  bitmap_set_multiple (to->used_map, page_idx, cnt, false);
+  adjust_free_cnt (to, cnt, 0);
+  to->page_cnt += cnt;
+  to->borrowed_cnt += cnt;
+  to->loan_cnt++;
+  lock_release (&to->lock);
+  return true;
+}
+
+/* Adds ADD to and subtracts SUB from POOL's count of free
+   pages. */
+static void
+adjust_free_cnt (struct pool *pool, size_t add, size_t sub) 
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt = pool->free_cnt + add - sub;
+  intr_set_level (old_level);
+}
+
+/* Marks the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   have just been allocated, as no longer known to be zero.
+   Returns the number of them that were zero.  POOL's lock must
+   be held. */
+static size_t
+take_zeroed (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t zeroed_cnt;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  if (pool->zeroed_cnt == 0)
+    return 0;
+  zeroed_cnt = bitmap_count (pool->zeroed_map, page_idx, page_cnt, true);
+  if (zeroed_cnt > 0)
+    {
+      bitmap_set_multiple (pool->zeroed_map, page_idx, page_cnt, false);
+      pool->zeroed_cnt -= zeroed_cnt;
+    }
+  return zeroed_cnt;
+}
+
+/* Returns the index of the first page in POOL at or after START
+   that is free but not known to be zero, or BITMAP_ERROR if
+   there is none.  Leapfrogs between word-at-a-time scans of the
+   two bitmaps, so runs of used or zeroed pages are skipped
+   quickly.  POOL's lock must be held. */
+static size_t
+find_unzeroed (struct pool *pool, size_t start)
+{
+  size_t idx = start;
+
+  for (;;)
+    {
+      idx = bitmap_scan (pool->used_map, idx, 1, false);
+      if (idx == BITMAP_ERROR || !bitmap_test (pool->zeroed_map, idx))
+        return idx;
+      idx = bitmap_scan (pool->zeroed_map, idx, 1, false);
+      if (idx == BITMAP_ERROR)
+        return idx;
+    }
+}
+
+/* Returns page PAGE_IDX, which the idle thread took out of POOL
+   and zeroed, to POOL as a free, zeroed page.  POOL's lock must
+   be held. */
+static void
+finish_zeroing (struct pool *pool, size_t page_idx)
+{
+  bitmap_mark (pool->zeroed_map, page_idx);
+  pool->zeroed_cnt++;
+  bitmap_reset (pool->used_map, page_idx);
+}
+
+/* Zeroes one free page in POOL that is not yet in its
+   zeroed_map, if POOL's lock is free.  Returns true if a page
+   was zeroed.
+
+   The idle thread must never block, and must not hold the lock
+   for long either, because once it is preempted it runs again
+   only when nothing else is runnable.  So the page is marked in
+   use while it is zeroed with the lock released, and if the
+   lock is busy afterward the page is left pending until the
+   next call.  (POOL's free_cnt still counts the page meanwhile,
+   which only affects balancing.) */
+static bool
+zero_free_page (struct pool *pool)
+{
+  size_t page_idx;
+
+  if (pool->zero_pending == BITMAP_ERROR
+      && pool->zeroed_cnt >= pool->free_cnt)
+    return false;
+  if (!lock_try_acquire (&pool->lock))
+    return false;
+
+  if (pool->zero_pending != BITMAP_ERROR)
+    {
+      finish_zeroing (pool, pool->zero_pending);
+      pool->zero_pending = BITMAP_ERROR;
+    }
+
+  /* Look for a free, non-zeroed page, starting where we left
+     off last time and wrapping around once. */
+  page_idx = find_unzeroed (pool, pool->zero_cursor);
+  if (page_idx == BITMAP_ERROR && pool->zero_cursor > 0)
+    page_idx = find_unzeroed (pool, 0);
+  if (page_idx == BITMAP_ERROR)
+    {
+      lock_release (&pool->lock);
+      return false;
+    }
+  bitmap_mark (pool->used_map, page_idx);
+  pool->zero_cursor = (page_idx + 1) % bitmap_size (pool->used_map);
+  lock_release (&pool->lock);
+
+  memset (pool_base + PGSIZE * page_idx, 0, PGSIZE);
+
+  if (lock_try_acquire (&pool->lock))
+    {
+      finish_zeroing (pool, page_idx);
+      lock_release (&pool->lock);
+    }
+  else
+    pool->zero_pending = page_idx;
+  return true;
 }
@@ -384,7 +384,8 @@ thread_get_recent_cpu (void)
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
    ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   special case when the ready list is empty.  While it has the
+   CPU, it pre-zeroes free pages for the page allocator. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
@@ -398,6 +399,16 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready, so use the time to zero a free
+         page for a later PAL_ZERO allocation.  If we did, go back
+         and look for runnable threads again before halting. */
+      intr_enable ();
+      if (palloc_zero_idle_page ())
+        continue;
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -463,6 +474,13 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+  list_init (&t->files);
+  t->next_fd = 2;
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
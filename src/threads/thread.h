@@ -3,6 +3,9 @@
 
 #include <debug.h>
 #include <list.h>
+#ifdef VM
+#include <hash.h>
+#endif
 #include <stdint.h>
 
 /* States in a thread's life cycle. */
@@ -76,10 +79,11 @@ typedef int tid_t;
    value, triggering the assertion. */
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
+   semaphore wait list (synch.c) or in the list of sleeping
+   threads (devices/timer.c).  It can be used these ways only
+   because they are mutually exclusive: only a thread in the
    ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   blocked state is on a wait list or sleeping. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -90,12 +94,43 @@ struct thread
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
 
-    /* Shared between thread.c and synch.c. */
+    /* Shared between thread.c, synch.c, and devices/timer.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /* Tick to wake up at, if asleep. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list files;                  /* Open files. */
+    int next_fd;                        /* Next file descriptor. */
+    void *syscall_page;                 /* Kernel copy of user data. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    long long major_faults;             /* Page faults that read disk. */
+    long long minor_faults;             /* Page faults that did not. */
+    void *ra_next;                      /* Expected next file fault. */
+    size_t ra_window;                   /* Pages to read ahead. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* Executable, for demand paging. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+    void *user_esp;                     /* User esp in system call. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nested journal operations. */
+    int journal_used;                   /* Sectors the operation used. */
 #endif
 
     /* Owned by thread.c. */
@@ -4,6 +4,11 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +153,32 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef FILESYS
+  /* Faulting in a page can write back a mapped file, which must
+     not happen inside a file system operation (see journal.c). */
+  ASSERT (user || thread_current ()->journal_depth == 0);
+#endif
+
+#ifdef VM
+  /* Bring in the page from the supplemental page table, or grow
+     the stack.  This also covers the kernel touching user memory
+     on a process's behalf, in which case F's stack pointer is the
+     kernel's and we need the one saved on entry to the system
+     call. */
+  if (not_present
+      && page_fault_in (fault_addr,
+                        user ? f->esp : thread_current ()->user_esp))
+    return;
+
+  /* The kernel touched a user address on a process's behalf that
+     could not be brought in.  That is the process's bad pointer,
+     not a kernel bug, so it dies as if it had passed one to a
+     system call. */
+  if (!user && is_user_vaddr (fault_addr)
+      && thread_current ()->pagedir != NULL)
+    syscall_exit (-1);
+#endif
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -1,24 +1,60 @@
 #include "userprog/pagedir.h"
+#include <bitmap.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/loader.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vpage);
+
+/* Clearing more than this many pages at once flushes the whole
+   TLB instead of invalidating the pages one by one. */
+#define INVLPG_MAX 32
+
+/* Number of PDEs that map user virtual memory. */
+#define USER_PDE_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Bookkeeping for a process page directory, kept in the page
+   just after the directory itself.  It lets pagedir_destroy()
+   visit only the page tables, and the PTEs within them, that the
+   process actually used. */
+struct pagedir_usage
+  {
+    uint16_t pte_cnt[USER_PDE_CNT];     /* Present PTEs per page table. */
+    struct bitmap *pt_map;              /* User PDEs with a page table. */
+    uint8_t pt_map_buf[];               /* Storage for pt_map. */
+  };
+
+static struct pagedir_usage *pagedir_usage (uint32_t *);
+static void count_pte (uint32_t *pd, const void *vaddr, int delta);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.
+
+   The new directory starts out zeroed, so only the kernel PDEs
+   that are actually present need to be copied in. */
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_multiple (PAL_ZERO, 2);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      struct pagedir_usage *u = pagedir_usage (pd);
+      size_t first = pd_no (PHYS_BASE);
+      size_t last = pd_no (ptov (init_ram_pages * PGSIZE - 1));
+
+      memcpy (pd + first, init_page_dir + first,
+              (last - first + 1) * sizeof *pd);
+      u->pt_map = bitmap_create_in_buf (USER_PDE_CNT, u->pt_map_buf,
+                                        bitmap_buf_size (USER_PDE_CNT));
+    }
   return pd;
 }
 
@@ -27,24 +63,34 @@ pagedir_create (void)
 void
 pagedir_destroy (uint32_t *pd) 
 {
-  uint32_t *pde;
+  struct pagedir_usage *u;
+  size_t pde_idx;
 
   if (pd == NULL)
     return;
 
   ASSERT (pd != init_page_dir);
-  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
-      {
-        uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-        
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+  u = pagedir_usage (pd);
+  for (pde_idx = bitmap_scan (u->pt_map, 0, 1, true);
+       pde_idx != BITMAP_ERROR;
+       pde_idx = bitmap_scan (u->pt_map, pde_idx + 1, 1, true))
+    {
+      uint32_t *pt = pde_get_pt (pd[pde_idx]);
+      size_t left = u->pte_cnt[pde_idx];
+      uint32_t *pte;
+
+      for (pte = pt; left > 0; pte++)
+        {
+          ASSERT (pte < pt + PGSIZE / sizeof *pte);
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
-      }
-  palloc_free_page (pd);
+            {
+              palloc_free_page (pte_get_page (*pte));
+              left--;
+            }
+        }
+      palloc_free_page (pt);
+    }
+  palloc_free_multiple (pd, 2);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -75,6 +121,7 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
             return NULL; 
       
           *pde = pde_create (pt);
+          bitmap_mark (pagedir_usage (pd)->pt_map, pd_no (vaddr));
         }
       else
         return NULL;
@@ -112,6 +159,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     {
       ASSERT ((*pte & PTE_P) == 0);
       *pte = pte_create_user (kpage, writable);
+      count_pte (pd, upage, 1);
       return true;
     }
   else
@@ -152,10 +200,55 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      count_pte (pd, upage, -1);
+      invalidate_page (pd, upage);
     }
 }
 
+/* Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+   present" in page directory PD, like pagedir_clear_page().
+   Page tables that map nothing are skipped whole, so clearing a
+   mostly empty range is cheap.  The first few pages cleared are
+   invalidated one at a time; past that, the whole TLB is flushed
+   once at the end.  Accessed and dirty bits are kept. */
+void
+pagedir_clear_range (uint32_t *pd, void *upage, size_t page_cnt) 
+{
+  struct pagedir_usage *u = pagedir_usage (pd);
+  uintptr_t page = (uintptr_t) upage;
+  uintptr_t end = page + page_cnt * PGSIZE;
+  size_t cleared_cnt = 0;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (page_cnt == 0 || is_user_vaddr ((void *) (end - PGSIZE)));
+
+  while (page < end)
+    {
+      size_t pde_idx = pd_no ((void *) page);
+      uintptr_t pt_end = (uintptr_t) (pde_idx + 1) << PDSHIFT;
+      uintptr_t stop = pt_end < end ? pt_end : end;
+
+      if ((pd[pde_idx] & PTE_P) != 0 && u->pte_cnt[pde_idx] > 0)
+        {
+          uint32_t *pt = pde_get_pt (pd[pde_idx]);
+          for (; page < stop; page += PGSIZE)
+            {
+              uint32_t *pte = &pt[pt_no ((void *) page)];
+              if ((*pte & PTE_P) != 0)
+                {
+                  *pte &= ~PTE_P;
+                  count_pte (pd, (void *) page, -1);
+                  if (++cleared_cnt <= INVLPG_MAX)
+                    invalidate_page (pd, (void *) page);
+                }
+            }
+        }
+      page = stop;
+    }
+  if (cleared_cnt > INVLPG_MAX)
+    invalidate_pagedir (pd);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +273,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,7 +302,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -243,6 +336,24 @@ active_pd (void)
   return ptov (pd);
 }
 
+/* Returns the bookkeeping for process page directory PD. */
+static struct pagedir_usage *
+pagedir_usage (uint32_t *pd) 
+{
+  ASSERT (pd != init_page_dir);
+  return (struct pagedir_usage *) (pd + PGSIZE / sizeof *pd);
+}
+
+/* Adds DELTA to the count of present PTEs in the page table
+   that maps VADDR in PD. */
+static void
+count_pte (uint32_t *pd, const void *vaddr, int delta) 
+{
+  struct pagedir_usage *u = pagedir_usage (pd);
+  u->pte_cnt[pd_no (vaddr)] += delta;
+  ASSERT (u->pte_cnt[pd_no (vaddr)] <= PGSIZE / sizeof *pd);
+}
+
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
    table.  When this happens, we have to "invalidate" the TLB by
@@ -261,3 +372,14 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+   active page directory.  Unlike invalidate_pagedir(), this
+   leaves the rest of the TLB alone.  See [IA32-v2a] "INVLPG--
+   Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vpage) 
+{
+  if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+}
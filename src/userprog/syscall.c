@@ -1,20 +1,595 @@
 #include "userprog/syscall.h"
+#include <list.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* An open file. */
+struct file_descriptor
+  {
+    struct list_elem elem;      /* Element in thread's `files'. */
+    int handle;                 /* File descriptor. */
+    struct file *file;          /* Open file. */
+  };
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+    int handle;                 /* Mapping identifier. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* First mapped page. */
+    size_t page_cnt;            /* Number of mapped pages. */
+  };
+
+static void unmap (struct mapping *);
+#endif
 
 static void syscall_handler (struct intr_frame *);
+static void get_args (const struct intr_frame *, uint32_t *args, int cnt);
+static void check_user (const void *uaddr, size_t size, bool write);
+static char *copy_in_string (const char *us);
+static void *get_syscall_page (void);
+static void free_syscall_page (void *);
+static struct file_descriptor *lookup_fd (int handle);
+
+static void sys_halt (void) NO_RETURN;
+static void sys_exit (int status) NO_RETURN;
+static bool sys_create (const char *ufile, unsigned initial_size);
+static bool sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *ubuf, unsigned size);
+static int sys_write (int handle, const void *ubuf, unsigned size);
+static void sys_seek (int handle, unsigned position);
+static unsigned sys_tell (int handle);
+static void sys_close (int handle);
+#ifdef VM
+static int sys_mmap (int handle, void *addr);
+static void sys_munmap (int mapping);
+#endif
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Dispatches the system call whose number and arguments are on
+   the user stack in F. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  uint32_t args[4];             /* System call number, arguments. */
+
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
+  get_args (f, args, 0);
+  switch (args[0])
+    {
+    case SYS_HALT:
+      sys_halt ();
+
+    case SYS_EXIT:
+      get_args (f, args, 1);
+      sys_exit (args[1]);
+
+    case SYS_CREATE:
+      get_args (f, args, 2);
+      f->eax = sys_create ((const char *) args[1], args[2]);
+      break;
+
+    case SYS_REMOVE:
+      get_args (f, args, 1);
+      f->eax = sys_remove ((const char *) args[1]);
+      break;
+
+    case SYS_OPEN:
+      get_args (f, args, 1);
+      f->eax = sys_open ((const char *) args[1]);
+      break;
+
+    case SYS_FILESIZE:
+      get_args (f, args, 1);
+      f->eax = sys_filesize (args[1]);
+      break;
+
+    case SYS_READ:
+      get_args (f, args, 3);
+      f->eax = sys_read (args[1], (void *) args[2], args[3]);
+      break;
+
+    case SYS_WRITE:
+      get_args (f, args, 3);
+      f->eax = sys_write (args[1], (const void *) args[2], args[3]);
+      break;
+
+    case SYS_SEEK:
+      get_args (f, args, 2);
+      sys_seek (args[1], args[2]);
+      break;
+
+    case SYS_TELL:
+      get_args (f, args, 1);
+      f->eax = sys_tell (args[1]);
+      break;
+
+    case SYS_CLOSE:
+      get_args (f, args, 1);
+      sys_close (args[1]);
+      break;
+
+#ifdef VM
+    case SYS_MMAP:
+      get_args (f, args, 2);
+      f->eax = sys_mmap (args[1], (void *) args[2]);
+      break;
+
+    case SYS_MUNMAP:
+      get_args (f, args, 1);
+      sys_munmap (args[1]);
+      break;
+#endif
+
+    default:
+      sys_exit (-1);
+    }
+}
+
+/* Copies the system call number and the first CNT arguments from
+   the user stack in F into ARGS[0] through ARGS[CNT], killing the
+   process if the stack is not valid. */
+static void
+get_args (const struct intr_frame *f, uint32_t *args, int cnt)
+{
+  const uint32_t *usp = f->esp;
+  int i;
+
+  check_user (usp, (cnt + 1) * sizeof *usp, false);
+  for (i = 0; i <= cnt; i++)
+    args[i] = usp[i];
+}
+
+/* Returns true if the current process may access the page that
+   contains user virtual address UADDR, and write to it if WRITE
+   is true.  Access to a page that is not yet in memory, or that
+   would grow the stack, is allowed: the kernel's access faults
+   it in. */
+static bool
+user_page_ok (const void *uaddr, bool write UNUSED)
+{
+  if (!is_user_vaddr (uaddr))
+    return false;
+#ifdef VM
+  {
+    struct page *p = page_lookup (uaddr);
+    if (p == NULL)
+      return page_is_stack_access (uaddr, thread_current ()->user_esp);
+    return p->writable || !write;
+  }
+#else
+  return pagedir_get_page (thread_current ()->pagedir, uaddr) != NULL;
+#endif
+}
+
+/* Kills the current process unless it may access the SIZE bytes
+   at user virtual address UADDR, for writing if WRITE is true. */
+static void
+check_user (const void *uaddr, size_t size, bool write)
+{
+  const uint8_t *first = uaddr;
+  const uint8_t *last = first + size - 1;
+  const uint8_t *p;
+
+  if (size == 0)
+    return;
+  if (last < first || !user_page_ok (last, write))
+    sys_exit (-1);
+  for (p = pg_round_down (first); p < last; p += PGSIZE)
+    if (!user_page_ok (p, write))
+      sys_exit (-1);
+}
+
+/* Allocates a page for a system call to copy user data into, or
+   returns a null pointer if memory is exhausted.  The page is
+   recorded in the thread, so that it is freed even if the
+   process is killed while copying (see syscall_exit()).  The
+   caller must free it with free_syscall_page(). */
+static void *
+get_syscall_page (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->syscall_page == NULL);
+  cur->syscall_page = palloc_get_page (0);
+  return cur->syscall_page;
+}
+
+/* Frees PAGE, obtained from get_syscall_page(). */
+static void
+free_syscall_page (void *page)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (page == cur->syscall_page);
+  cur->syscall_page = NULL;
+  palloc_free_page (page);
+}
+
+/* Copies the null-terminated string at user virtual address US
+   into a new page and returns it, killing the process if US is
+   invalid.  Truncates strings longer than a page.  The caller
+   must free the page with free_syscall_page(). */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  size_t length;
+
+  ks = get_syscall_page ();
+  if (ks == NULL)
+    sys_exit (-1);
+  for (length = 0; length < PGSIZE; length++)
+    {
+      if (length == 0 || pg_ofs (us + length) == 0)
+        if (!user_page_ok (us + length, false))
+          sys_exit (-1);
+      ks[length] = us[length];
+      if (ks[length] == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Returns the current process's open file with the given
+   HANDLE, or a null pointer if there is none. */
+static struct file_descriptor *
+lookup_fd (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->files); e != list_end (&cur->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *fd;
+      fd = list_entry (e, struct file_descriptor, elem);
+      if (fd->handle == handle)
+        return fd;
+    }
+  return NULL;
+}
+
+/* Halt system call. */
+static void
+sys_halt (void)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static void
+sys_exit (int status)
+{
+  syscall_exit (status);
+}
+
+/* Create system call. */
+static bool
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char *kfile = copy_in_string (ufile);
+  bool success = filesys_create (kfile, initial_size);
+  free_syscall_page (kfile);
+  return success;
+}
+
+/* Remove system call. */
+static bool
+sys_remove (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  bool success = filesys_remove (kfile);
+  free_syscall_page (kfile);
+  return success;
+}
+
+/* Open system call. */
+static int
+sys_open (const char *ufile)
+{
+  struct thread *cur = thread_current ();
+  char *kfile = copy_in_string (ufile);
+  struct file_descriptor *fd;
+  int handle = -1;
+
+  fd = malloc (sizeof *fd);
+  if (fd != NULL)
+    {
+      fd->file = filesys_open (kfile);
+      if (fd->file != NULL)
+        {
+          handle = fd->handle = cur->next_fd++;
+          list_push_back (&cur->files, &fd->elem);
+        }
+      else
+        free (fd);
+    }
+  free_syscall_page (kfile);
+  return handle;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? file_length (fd->file) : -1;
+}
+
+/* Read system call.  File data passes through a kernel page,
+   so that the user's buffer is never touched, and possibly
+   faulted in, while the file system holds its locks. */
+static int
+sys_read (int handle, void *ubuf, unsigned size)
+{
+  struct file_descriptor *fd;
+  uint8_t *udst = ubuf;
+  uint8_t *kbuf;
+  int total = 0;
+
+  check_user (ubuf, size, true);
+  if (handle == STDIN_FILENO)
+    {
+      unsigned i;
+
+      for (i = 0; i < size; i++)
+        udst[i] = input_getc ();
+      return size;
+    }
+
+  fd = lookup_fd (handle);
+  if (fd == NULL)
+    return -1;
+  kbuf = get_syscall_page ();
+  if (kbuf == NULL)
+    return -1;
+  while (size > 0)
+    {
+      size_t chunk = size < PGSIZE ? size : PGSIZE;
+      off_t read = file_read (fd->file, kbuf, chunk);
+
+      memcpy (udst + total, kbuf, read);
+      total += read;
+      size -= read;
+      if ((size_t) read != chunk)
+        break;
+    }
+  free_syscall_page (kbuf);
+  return total;
+}
+
+/* Write system call.  Like sys_read(), copies the user's data
+   into a kernel page before handing it to the file system or
+   the console, so that no user page is faulted in while either
+   holds a lock. */
+static int
+sys_write (int handle, const void *ubuf, unsigned size)
+{
+  struct file_descriptor *fd;
+  const uint8_t *usrc = ubuf;
+  uint8_t *kbuf;
+  int total = 0;
+
+  check_user (ubuf, size, false);
+  if (handle == STDOUT_FILENO)
+    fd = NULL;
+  else
+    {
+      fd = lookup_fd (handle);
+      if (fd == NULL)
+        return -1;
+    }
+
+  kbuf = get_syscall_page ();
+  if (kbuf == NULL)
+    return -1;
+  while (size > 0)
+    {
+      size_t chunk = size < PGSIZE ? size : PGSIZE;
+      off_t written;
+
+      memcpy (kbuf, usrc + total, chunk);
+      if (fd != NULL)
+        written = file_write (fd->file, kbuf, chunk);
+      else
+        {
+          putbuf ((const char *) kbuf, chunk);
+          written = chunk;
+        }
+      total += written;
+      size -= written;
+      if ((size_t) written != chunk)
+        break;
+    }
+  free_syscall_page (kbuf);
+  return total;
+}
+
+/* Seek system call. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+sys_seek (int handle, unsigned position)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  if (fd != NULL && (off_t) position >= 0)
+    file_seek (fd->file, position);
+}
+
+/* Tell system call. */
+static unsigned
+sys_tell (int handle)
 {
-  printf ("system call!\n");
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? (unsigned) file_tell (fd->file) : 0;
+}
+
+/* Close system call. */
+static void
+sys_close (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  if (fd != NULL)
+    {
+      file_close (fd->file);
+      list_remove (&fd->elem);
+      free (fd);
+    }
+}
+
+#ifdef VM
+/* Mmap system call.  Maps the file open as HANDLE at ADDR, which
+   must be page-aligned, with nothing else mapped in the pages
+   that the file would cover.  Pages are read in from the file
+   when first touched and written back only if modified, so no
+   data is copied until it is used. */
+static int
+sys_mmap (int handle, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct file_descriptor *fd = lookup_fd (handle);
+  struct mapping *m;
+  off_t length;
+
+  if (fd == NULL || addr == NULL || pg_ofs (addr) != 0)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  m->file = file_reopen (fd->file);
+  m->base = addr;
+  m->page_cnt = 0;
+  if (m->file == NULL)
+    {
+      free (m);
+      return -1;
+    }
+
+  length = file_length (m->file);
+  while ((off_t) (m->page_cnt * PGSIZE) < length)
+    {
+      off_t ofs = m->page_cnt * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      uint8_t *upage = m->base + ofs;
+
+      if (!is_user_vaddr (upage)
+          || !page_add_mmap (upage, m->file, ofs, read_bytes))
+        {
+          unmap (m);
+          return -1;
+        }
+      m->page_cnt++;
+    }
+  if (m->page_cnt == 0)
+    {
+      unmap (m);
+      return -1;
+    }
+
+  m->handle = cur->next_mapid++;
+  list_push_back (&cur->mappings, &m->elem);
+  return m->handle;
+}
+
+/* Munmap system call. */
+static void
+sys_munmap (int mapping)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == mapping)
+        {
+          list_remove (&m->elem);
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/* Removes M's pages, writing back any that were modified, and
+   frees M.  The whole range is unmapped first, so the TLB is
+   flushed once rather than once per page. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  pagedir_clear_range (thread_current ()->pagedir, m->base, m->page_cnt);
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
+#endif
+
+/* Terminates the current process with exit code STATUS, the
+   same as if it had invoked the exit system call.  Also used to
+   kill a process whose bad pointer the kernel tripped over, in
+   which case a system call's kernel page may still be
+   allocated. */
+void
+syscall_exit (int status)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->syscall_page != NULL)
+    free_syscall_page (cur->syscall_page);
+  printf ("%s: exit(%d)\n", thread_name (), status);
   thread_exit ();
 }
+
+/* Removes the current process's memory mappings and closes its
+   open files.  Called when a process exits. */
+void
+syscall_close_all (void)
+{
+  struct thread *cur = thread_current ();
+
+#ifdef VM
+  while (!list_empty (&cur->mappings))
+    {
+      struct list_elem *e = list_pop_front (&cur->mappings);
+      unmap (list_entry (e, struct mapping, elem));
+    }
+#endif
+  while (!list_empty (&cur->files))
+    {
+      struct list_elem *e = list_pop_front (&cur->files);
+      struct file_descriptor *fd;
+
+      fd = list_entry (e, struct file_descriptor, elem);
+      file_close (fd->file);
+      free (fd);
+    }
+}
@@ -0,0 +1,169 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+#include "vm/share.h"
+
+/* One frame per page of physical memory, indexed by physical
+   page number.  Only frames in the user pool are ever used. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+/* Clock hand for choosing frames to evict.
+   Only one thread sweeps at a time. */
+static struct lock clock_lock;
+static size_t clock_hand;
+
+/* Number of frames evicted. */
+static long long evict_cnt;
+
+static struct frame *evict_frame (void);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  size_t i;
+
+  frame_cnt = init_ram_pages;
+  frames = malloc (frame_cnt * sizeof *frames);
+  if (frames == NULL)
+    PANIC ("frame table allocation failed");
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+
+      lock_init (&f->lock);
+      f->kpage = ptov (i * PGSIZE);
+      f->page = NULL;
+      f->share = NULL;
+    }
+  lock_init (&clock_lock);
+}
+
+/* Returns the frame for kernel virtual address KPAGE. */
+static struct frame *
+frame_of (void *kpage)
+{
+  return &frames[vtop (kpage) >> PGBITS];
+}
+
+/* Obtains a user frame to hold PAGE, evicting another page if
+   necessary and EVICT is true.  If EVICT is false, the request
+   is speculative, as for read-ahead, and takes only a frame that
+   is free in the user pool, without borrowing kernel pages
+   either.  PAGE may be null if the caller will set the frame's
+   SHARE instead.  If FLAGS includes
+   PAL_ZERO, the frame is zeroed.
+   Returns the frame, locked, or a null pointer if no frame could
+   be obtained.  The caller must release it with frame_unlock()
+   once PAGE is mapped. */
+struct frame *
+frame_alloc (struct page *page, enum palloc_flags flags, bool evict)
+{
+  void *kpage = palloc_get_page (PAL_USER | (flags & PAL_ZERO)
+                                 | (evict ? 0 : PAL_NOBORROW));
+  struct frame *f;
+
+  if (kpage != NULL)
+    {
+      f = frame_of (kpage);
+      lock_acquire (&f->lock);
+    }
+  else
+    {
+      f = evict ? evict_frame () : NULL;
+      if (f == NULL)
+        return NULL;
+      if (flags & PAL_ZERO)
+        memset (f->kpage, 0, PGSIZE);
+    }
+  f->page = page;
+  return f;
+}
+
+/* Frees frame F, which the caller must have locked. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  f->page = NULL;
+  f->share = NULL;
+  lock_release (&f->lock);
+  palloc_free_page (f->kpage);
+}
+
+/* Unlocks frame F, making it a candidate for eviction. */
+void
+frame_unlock (struct frame *f)
+{
+  lock_release (&f->lock);
+}
+
+/* Chooses an in-use frame with the clock algorithm, pages its
+   contents out, and returns it, locked.  Frames that are locked
+   or whose page was accessed since the hand last passed are
+   skipped, so two sweeps always suffice unless every frame is
+   pinned or swap is full.  Returns a null pointer in that
+   case. */
+static struct frame *
+evict_frame (void)
+{
+  size_t i;
+
+  lock_acquire (&clock_lock);
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f = &frames[clock_hand];
+
+      if (++clock_hand >= frame_cnt)
+        clock_hand = 0;
+      if ((f->page == NULL && f->share == NULL)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (f->share != NULL)
+        {
+          /* Shared pages are read-only, so this needs no I/O. */
+          if (share_evict (f->share))
+            {
+              f->share = NULL;
+              evict_cnt++;
+              lock_release (&clock_lock);
+              return f;
+            }
+          lock_release (&f->lock);
+          continue;
+        }
+      if (f->page == NULL || page_accessed_recently (f->page))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      /* Write out the victim without holding up other
+         evictions. */
+      lock_release (&clock_lock);
+      if (page_out (f->page))
+        {
+          f->page = NULL;
+          evict_cnt++;
+          return f;
+        }
+      lock_release (&f->lock);
+      lock_acquire (&clock_lock);
+    }
+  lock_release (&clock_lock);
+  return NULL;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %lld evicted\n", evict_cnt);
+}
@@ -0,0 +1,32 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+struct page;
+struct share;
+
+/* A physical frame that can hold a user page.
+
+   There is one of these for every page of physical memory,
+   whether or not it is in use, so that LOCK outlives any
+   particular use of the frame.  Holding LOCK pins the frame:
+   the clock algorithm skips it, and PAGE and SHARE cannot
+   change.  A frame with neither PAGE nor SHARE is free. */
+struct frame
+  {
+    struct lock lock;           /* Pins the frame. */
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Private page held, or null. */
+    struct share *share;        /* Shared page held, or null. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, enum palloc_flags, bool evict);
+void frame_free (struct frame *);
+void frame_unlock (struct frame *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
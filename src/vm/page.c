@@ -0,0 +1,509 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Number of pages in a fault-around block.  Must be a power
+   of 2, and no more than a page table maps, so that the block
+   never reaches past the page table of the faulting page. */
+#define FAULT_AROUND 8
+#if FAULT_AROUND > 1024
+#error "FAULT_AROUND is larger than a page table."
+#endif
+
+/* Maximum number of pages read ahead of a sequential fault. */
+#define READ_AHEAD_MAX 8
+
+/* Default maximum size of a user stack, in pages. */
+#define STACK_PAGES_DEFAULT 2048
+
+/* Largest distance below the stack pointer at which an access
+   grows the stack.  PUSHA stores 32 bytes below it before moving
+   it. */
+#define STACK_SLOP 32
+
+/* -sl: Maximum size of a user stack, in pages. */
+size_t page_stack_limit = STACK_PAGES_DEFAULT;
+
+/* Number of page faults that did and did not read from disk. */
+static long long major_cnt, minor_cnt;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static bool in_stack_region (const void *uaddr);
+static bool load_page (struct page *, bool evict, bool *io);
+static void fault_around (struct page *);
+static void read_ahead (struct page *);
+static struct page *new_page (void *upage, enum page_type, bool writable);
+static bool add_page (struct page *);
+
+/* Initializes the current process's supplemental page table.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Frees one supplemental page table entry, along with its frame
+   and swap slot, if any.  A modified page of a mapped file is
+   written back first. */
+static void
+destroy_page (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+  struct frame *f = p->frame;
+
+  if (p->share != NULL)
+    {
+      share_detach (p);
+      free (p);
+      return;
+    }
+
+  /* Wait out any eviction in progress.  The page directory must
+     no longer map the frame once it is free. */
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (p->frame == f)
+        {
+          if (p->type == PAGE_MMAP
+              && pagedir_is_dirty (p->pagedir, p->upage))
+            file_write_at (p->file, f->kpage, p->read_bytes, p->file_ofs);
+          pagedir_clear_page (p->pagedir, p->upage);
+          frame_free (f);
+        }
+      else
+        frame_unlock (f);
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  free (p);
+}
+
+/* Destroys the current process's supplemental page table.  Must
+   be called before the page directory is destroyed.  All user
+   mappings are dropped with one TLB flush up front, so that
+   freeing the pages one by one need not invalidate each. */
+void
+page_table_destroy (void)
+{
+  struct thread *cur = thread_current ();
+
+  pagedir_clear_range (cur->pagedir, NULL, pg_no (PHYS_BASE));
+  hash_destroy (&cur->pages, destroy_page);
+}
+
+/* Adds a page at user virtual address UPAGE to the current
+   process, whose initial contents are READ_BYTES bytes read from
+   FILE starting at offset OFS followed by PGSIZE - READ_BYTES
+   zero bytes.  Nothing is read until the page is first accessed,
+   so FILE must stay open until the page table is destroyed.
+   If WRITABLE is true, the user process may modify the page;
+   otherwise, it is shared with every other process that maps the
+   same part of the same file read-only.
+   Returns true if successful, false if UPAGE is already in use
+   or memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  if (read_bytes == 0)
+    return page_add_zero (upage, writable);
+
+  p = new_page (upage, PAGE_FILE, writable);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  if (!add_page (p))
+    return false;
+  if (!writable)
+    share_attach (p);
+  return true;
+}
+
+/* Adds an all-zero page at user virtual address UPAGE to the
+   current process.  No memory is allocated for it until it is
+   first accessed.
+   If WRITABLE is true, the user process may modify the page.
+   Returns true if successful, false if UPAGE is already in use
+   or memory allocation fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct page *p = new_page (upage, PAGE_ZERO, writable);
+  return p != NULL && add_page (p);
+}
+
+/* Adds a page at user virtual address UPAGE to the current
+   process that maps READ_BYTES bytes of FILE starting at offset
+   OFS, followed by PGSIZE - READ_BYTES zero bytes.  The page is
+   read in when first accessed and, if the process modifies it,
+   written back to FILE when it is evicted or removed.
+   Returns true if successful, false if UPAGE is already in use
+   or reserved for the stack, or if memory allocation fails. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (read_bytes > 0 && read_bytes <= PGSIZE);
+
+  if (in_stack_region (upage))
+    return false;
+  p = new_page (upage, PAGE_MMAP, true);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  return add_page (p);
+}
+
+/* Removes the current process's page at UPAGE, which must
+   exist, as if the process had exited. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (&thread_current ()->pages, &p->hash_elem);
+  destroy_page (&p->hash_elem, NULL);
+}
+
+/* Allocates and returns a page of the given TYPE at UPAGE in the
+   current process, not yet in its page table, or a null pointer
+   if memory is exhausted. */
+static struct page *
+new_page (void *upage, enum page_type type, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->pagedir = thread_current ()->pagedir;
+  p->writable = writable;
+  p->type = type;
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->share = NULL;
+  return p;
+}
+
+/* Inserts P into the current process's supplemental page table.
+   Frees P and returns false if its page is already in use. */
+static bool
+add_page (struct page *p)
+{
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return false;
+    }
+  return true;
+}
+
+/* Returns the current process's page containing user virtual
+   address UADDR, or a null pointer if there is none. */
+struct page *
+page_lookup (const void *uaddr)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (uaddr);
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns true if UADDR lies in the region at the top of user
+   memory that the stack may grow into. */
+static bool
+in_stack_region (const void *uaddr)
+{
+  return (is_user_vaddr (uaddr)
+          && pg_no (PHYS_BASE) - pg_no (uaddr) <= page_stack_limit);
+}
+
+/* Returns true if an access to UADDR, which is not part of the
+   current process's address space, by code whose stack pointer
+   is ESP should add a page to the stack.  The access must be no
+   more than STACK_SLOP bytes below ESP, which rules out wild
+   pointers into the stack region, and the stack may not grow
+   past page_stack_limit pages.  page_add_mmap() keeps mappings
+   out of that region, so the stack never grows into one. */
+bool
+page_is_stack_access (const void *uaddr, const void *esp)
+{
+  return (in_stack_region (uaddr)
+          && (uintptr_t) uaddr + STACK_SLOP >= (uintptr_t) esp);
+}
+
+/* Brings in the page containing FAULT_ADDR, which the current
+   process accessed without it being mapped, and maps it.  ESP is
+   the process's user stack pointer, used to decide whether the
+   access should grow the stack.
+   Returns true if successful, false if FAULT_ADDR is not part of
+   the process's address space or the page could not be loaded,
+   in which case the access was invalid and the process should
+   be killed. */
+bool
+page_fault_in (const void *fault_addr, const void *esp)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool io = false;
+
+  if (t->pagedir == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (fault_addr);
+  if (p == NULL && page_is_stack_access (fault_addr, esp))
+    {
+      /* Grow the stack. */
+      if (!page_add_zero (pg_round_down (fault_addr), true))
+        return false;
+      p = page_lookup (fault_addr);
+    }
+  if (p == NULL || !load_page (p, true, &io))
+    return false;
+
+  if (io)
+    {
+      t->major_faults++;
+      major_cnt++;
+    }
+  else
+    {
+      t->minor_faults++;
+      minor_cnt++;
+    }
+  if (p->file != NULL)
+    {
+      fault_around (p);
+      read_ahead (p);
+    }
+  return true;
+}
+
+/* Brings P, a page of the current process, into memory and maps
+   it, setting *IO to true if that took a disk read.  If EVICT is
+   false, fails rather than evicting another page to make room.
+   Returns true if successful, false on failure. */
+static bool
+load_page (struct page *p, bool evict, bool *io)
+{
+  struct frame *f;
+
+  if (p->share != NULL)
+    return share_fault_in (p, evict, io);
+
+  /* If the page is being evicted, wait for that to finish.  If
+     it turns out to still be in memory, just retry the access. */
+  f = p->frame;
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      frame_unlock (f);
+      if (p->frame != NULL)
+        return true;
+    }
+
+  /* Get a frame and fill it. */
+  f = frame_alloc (p, (p->type == PAGE_ZERO && p->swap_slot == SWAP_ERROR
+                       ? PAL_ZERO : 0), evict);
+  if (f == NULL)
+    return false;
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      *io = true;
+      swap_read (p->swap_slot, f->kpage);
+    }
+  else if (p->type != PAGE_ZERO)
+    {
+      /* A full page is read straight into the frame, without
+         going through a bounce buffer. */
+      *io = true;
+      if (file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+
+  /* Map it. */
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  frame_unlock (f);
+  return true;
+}
+
+/* Maps the shared pages in the FAULT_AROUND-page aligned block
+   around P that other processes already have in memory, so that
+   touching them later does not fault.  This never reads from
+   disk or takes a frame.  The block lies within the page table
+   that maps P, which was just mapped, so pagedir_set_page() never
+   needs to allocate one here either. */
+static void
+fault_around (struct page *p)
+{
+  uint8_t *base = p->upage;
+  size_t i;
+
+  base -= pg_no (base) % FAULT_AROUND * PGSIZE;
+  for (i = 0; i < FAULT_AROUND; i++)
+    {
+      struct page *q = page_lookup (base + i * PGSIZE);
+      if (q != NULL && q != p && q->share != NULL && q->frame == NULL)
+        share_map_resident (q);
+    }
+}
+
+/* Called after a fault on P, a file-backed page.  If the current
+   process's faults on file pages have been sequential, reads in
+   and maps the pages that follow P, up to a window that doubles
+   with each sequential fault up to READ_AHEAD_MAX pages.  Read
+   ahead stops at the end of the file region, and takes only
+   free frames, never evicting. */
+static void
+read_ahead (struct page *p)
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = p->upage;
+  size_t i;
+
+  if (upage != t->ra_next)
+    {
+      /* Not sequential: start over. */
+      t->ra_window = 0;
+      t->ra_next = upage + PGSIZE;
+      return;
+    }
+
+  t->ra_window = (t->ra_window == 0 ? 1
+                  : t->ra_window * 2 < READ_AHEAD_MAX ? t->ra_window * 2
+                  : READ_AHEAD_MAX);
+  for (i = 1; i <= t->ra_window; i++)
+    {
+      struct page *next = page_lookup (upage + i * PGSIZE);
+      bool io = false;
+
+      if (next == NULL || next->file == NULL)
+        break;
+      if (next->frame == NULL && !load_page (next, false, &io))
+        break;
+    }
+
+  /* The next sequential fault, if any, comes after the pages just
+     read. */
+  t->ra_next = upage + i * PGSIZE;
+}
+
+/* Prints page fault statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Page faults: %lld major, %lld minor\n", major_cnt, minor_cnt);
+}
+
+/* Returns true if P, which must be in a frame locked by the
+   caller, has been accessed since the last call, clearing its
+   accessed bit. */
+bool
+page_accessed_recently (struct page *p)
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (!pagedir_is_accessed (p->pagedir, p->upage))
+    return false;
+  pagedir_set_accessed (p->pagedir, p->upage, false);
+  return true;
+}
+
+/* Evicts P from its frame, which the caller must have locked.
+   Unmaps P, then, if P was modified, writes it back to its
+   mapped file or saves it to swap; an unmodified page can be
+   recreated from its file, from zeros, or from the copy already
+   in swap.  Returns true if successful,
+   false if swap is full, in which case P stays mapped. */
+bool
+page_out (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (f != NULL);
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  /* Unmap first, so that the owner cannot dirty the page after
+     we check. */
+  pagedir_clear_page (p->pagedir, p->upage);
+  if (p->type == PAGE_MMAP)
+    {
+      if (pagedir_is_dirty (p->pagedir, p->upage))
+        file_write_at (p->file, f->kpage, p->read_bytes, p->file_ofs);
+    }
+  else if (pagedir_is_dirty (p->pagedir, p->upage))
+    {
+      if (p->swap_slot == SWAP_ERROR)
+        p->swap_slot = swap_alloc ();
+      if (p->swap_slot == SWAP_ERROR)
+        {
+          pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable);
+          pagedir_set_dirty (p->pagedir, p->upage, true);
+          return false;
+        }
+      swap_write (p->swap_slot, f->kpage);
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
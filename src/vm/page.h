@@ -0,0 +1,77 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct share;
+
+/* Where a page's contents come from the first time it is
+   accessed. */
+enum page_type
+  {
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_FILE,                  /* Read from a file, rest zeros. */
+    PAGE_MMAP                   /* Mapped file, written back if dirty. */
+  };
+
+/* A page of user virtual memory in the supplemental page table.
+
+   Every page a process may legally access has one of these, in
+   the process's `pages' hash table, whether or not it is
+   currently mapped in its page directory.  The page fault
+   handler uses it to bring the page in on first access and after
+   it has been evicted.
+
+   FRAME changes only while the frame's lock is held, so the
+   owner and an evicting thread synchronize on it.  Read-only
+   pages from files are instead attached to a `struct share'
+   (see vm/share.c), which owns the frame, and FRAME just records
+   whether the page is mapped. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's `pages'. */
+    void *upage;                        /* User virtual address. */
+    uint32_t *pagedir;                  /* Owner's page directory. */
+    bool writable;                      /* Writable by user? */
+    enum page_type type;                /* Initial contents. */
+    struct frame *frame;                /* Frame holding page, if any. */
+    size_t swap_slot;                   /* Copy in swap, or SWAP_ERROR. */
+
+    /* For PAGE_FILE and PAGE_MMAP. */
+    struct file *file;                  /* File to read. */
+    off_t file_ofs;                     /* Offset in FILE. */
+    size_t read_bytes;                  /* Bytes to read, rest zeroed. */
+
+    /* For read-only PAGE_FILE pages, normally. */
+    struct share *share;                /* Shared copy, or null. */
+    struct list_elem share_elem;        /* Element in share's `pages'. */
+  };
+
+/* -sl: Maximum size of a user stack, in pages. */
+extern size_t page_stack_limit;
+
+bool page_table_init (void);
+void page_table_destroy (void);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *uaddr);
+bool page_is_stack_access (const void *uaddr, const void *esp);
+bool page_fault_in (const void *fault_addr, const void *esp);
+
+bool page_accessed_recently (struct page *);
+bool page_out (struct page *);
+void page_print_stats (void);
+
+#endif /* vm/page.h */
@@ -0,0 +1,277 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* All shared pages, keyed by inode, offset, and length.
+
+   SHARE_LOCK protects `shares', each share's PAGES and FRAME,
+   and the FRAME of each page attached to a share.  The evictor
+   holds a frame's lock when it needs SHARE_LOCK, so it only
+   tries to acquire it.  The one place that waits for a frame
+   while holding SHARE_LOCK is share_detach(), for a frame that
+   no other page refers to and so nobody is reading in. */
+static struct hash shares;
+static struct lock share_lock;
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the shared page table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shares, share_hash, share_less, NULL))
+    PANIC ("shared page table allocation failed");
+  lock_init (&share_lock);
+}
+
+/* Attaches P, a read-only file page, to the share for the same
+   bytes of the same inode, creating it if necessary.  Returns
+   true if successful, false if memory is exhausted, in which
+   case P stays private. */
+bool
+share_attach (struct page *p)
+{
+  struct share key, *s;
+  struct hash_elem *e;
+
+  ASSERT (p->type == PAGE_FILE && !p->writable);
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+
+  lock_acquire (&share_lock);
+  e = hash_find (&shares, &key.hash_elem);
+  if (e != NULL)
+    s = hash_entry (e, struct share, hash_elem);
+  else
+    {
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        {
+          lock_release (&share_lock);
+          return false;
+        }
+      *s = key;
+      list_init (&s->pages);
+      s->frame = NULL;
+      hash_insert (&shares, &s->hash_elem);
+    }
+  list_push_back (&s->pages, &p->share_elem);
+  p->share = s;
+  lock_release (&share_lock);
+  return true;
+}
+
+/* Detaches P from its share, unmapping it.  Frees the share, and
+   its frame, if P was its last page. */
+void
+share_detach (struct page *p)
+{
+  struct share *s = p->share;
+
+  lock_acquire (&share_lock);
+  list_remove (&p->share_elem);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->pagedir, p->upage);
+      p->frame = NULL;
+    }
+  if (list_empty (&s->pages))
+    {
+      struct frame *f = s->frame;
+      if (f != NULL)
+        {
+          lock_acquire (&f->lock);
+          f->share = NULL;
+          frame_free (f);
+        }
+      hash_delete (&shares, &s->hash_elem);
+      free (s);
+    }
+  lock_release (&share_lock);
+  p->share = NULL;
+}
+
+/* Maps P, which is attached to a share and not mapped, to the
+   share's frame if it is in memory and not busy.  Does no I/O
+   and never waits.  Returns true if successful, false
+   otherwise. */
+bool
+share_map_resident (struct page *p)
+{
+  struct share *s = p->share;
+  struct frame *f;
+  bool success = false;
+
+  if (!lock_try_acquire (&share_lock))
+    return false;
+  f = s->frame;
+  if (f != NULL && lock_try_acquire (&f->lock))
+    {
+      success = pagedir_set_page (p->pagedir, p->upage, f->kpage, false);
+      if (success)
+        p->frame = f;
+      frame_unlock (f);
+    }
+  lock_release (&share_lock);
+  return success;
+}
+
+/* Maps P, which is attached to a share, to the share's frame,
+   reading it in if no process has it in memory, in which case
+   *IO is set to true.  If EVICT is false, fails rather than
+   evicting a page to make room.  Returns true if successful,
+   false on failure. */
+bool
+share_fault_in (struct page *p, bool evict, bool *io)
+{
+  struct share *s = p->share;
+  struct frame *new = NULL;
+  struct frame *f;
+
+  for (;;)
+    {
+      lock_acquire (&share_lock);
+      f = s->frame;
+      if (f != NULL)
+        {
+          /* Already in memory: map it, unless it is still being
+             read in or is being evicted, in which case wait for
+             that and look again. */
+          if (lock_try_acquire (&f->lock))
+            {
+              bool success = pagedir_set_page (p->pagedir, p->upage,
+                                               f->kpage, false);
+              if (success)
+                p->frame = f;
+              frame_unlock (f);
+              lock_release (&share_lock);
+              if (new != NULL)
+                frame_free (new);
+              return success;
+            }
+          lock_release (&share_lock);
+          lock_acquire (&f->lock);
+          frame_unlock (f);
+        }
+      else if (new == NULL)
+        {
+          /* Allocating a frame may evict a shared page, which
+             needs SHARE_LOCK, so do it without holding it. */
+          lock_release (&share_lock);
+          new = frame_alloc (NULL, 0, evict);
+          if (new == NULL)
+            return false;
+        }
+      else
+        break;
+    }
+
+  /* Claim the share with our frame, then read it in.  Other
+     mappers wait on the frame's lock meanwhile. */
+  f = new;
+  f->share = s;
+  s->frame = f;
+  lock_release (&share_lock);
+
+  *io = true;
+  if (file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs)
+      != (off_t) p->read_bytes)
+    goto fail;
+  memset ((uint8_t *) f->kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+
+  lock_acquire (&share_lock);
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, false))
+    {
+      lock_release (&share_lock);
+      goto fail;
+    }
+  p->frame = f;
+  frame_unlock (f);
+  lock_release (&share_lock);
+  return true;
+
+ fail:
+  lock_acquire (&share_lock);
+  s->frame = NULL;
+  f->share = NULL;
+  frame_free (f);
+  lock_release (&share_lock);
+  return false;
+}
+
+/* Tries to evict S from its frame, which the caller must have
+   locked, unmapping it from every process.  Fails if S was
+   accessed through any mapping since the clock hand last passed,
+   clearing the accessed bits, or if SHARE_LOCK is busy.  Shared
+   pages are never dirty, so there is nothing to write back. */
+bool
+share_evict (struct share *s)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  ASSERT (lock_held_by_current_thread (&s->frame->lock));
+
+  if (!lock_try_acquire (&share_lock))
+    return false;
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      if (p->frame != NULL && pagedir_is_accessed (p->pagedir, p->upage))
+        {
+          pagedir_set_accessed (p->pagedir, p->upage, false);
+          accessed = true;
+        }
+    }
+  if (!accessed)
+    {
+      for (e = list_begin (&s->pages); e != list_end (&s->pages);
+           e = list_next (e))
+        {
+          struct page *p = list_entry (e, struct page, share_elem);
+          if (p->frame != NULL)
+            {
+              pagedir_clear_page (p->pagedir, p->upage);
+              p->frame = NULL;
+            }
+        }
+      s->frame = NULL;
+    }
+  lock_release (&share_lock);
+  return !accessed;
+}
+
+/* Returns a hash value for the share that E refers to. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct share *s = hash_entry (e, struct share, hash_elem);
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if share A precedes share B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_entry (a_, struct share, hash_elem);
+  const struct share *b = hash_entry (b_, struct share, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,35 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A read-only file page that every process mapping the same
+   bytes of the same inode shares, such as a page of an
+   executable's code.  While any process has such a page in its
+   supplemental page table, there is exactly one of these for it,
+   and at most one frame holds its contents. */
+struct share
+  {
+    struct hash_elem hash_elem;         /* Element in `shares'. */
+    struct inode *inode;                /* Inode read from. */
+    off_t ofs;                          /* Offset in INODE. */
+    size_t read_bytes;                  /* Bytes read, rest zeroed. */
+    struct list pages;                  /* Mappers' `struct page's. */
+    struct frame *frame;                /* Frame holding it, if any. */
+  };
+
+void share_init (void);
+bool share_attach (struct page *);
+void share_detach (struct page *);
+bool share_map_resident (struct page *);
+bool share_fault_in (struct page *, bool evict, bool *io);
+bool share_evict (struct share *);
+
+#endif /* vm/share.h */
@@ -0,0 +1,99 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in one page-sized swap slot. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Swap slots in use, one bit per slot. */
+static struct bitmap *swap_map;
+static struct lock swap_lock;
+
+/* Number of pages read from and written to swap. */
+static long long read_cnt, write_cnt;
+
+/* Sets up swapping to the BLOCK_SWAP device, if there is one.
+   Without one, swap_alloc() always fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SLOT_SECTORS;
+  swap_map = bitmap_create (slot_cnt);
+  if (swap_map == NULL)
+    PANIC ("swap bitmap creation failed--swap device is too large");
+  lock_init (&swap_lock);
+}
+
+/* Allocates a swap slot and returns its index, or SWAP_ERROR if
+   swap is full. */
+size_t
+swap_alloc (void)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  lock_release (&swap_lock);
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Frees swap slot SLOT, which must be in use. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_all (swap_map, slot, 1));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}
+
+/* Reads the page in swap slot SLOT into KPAGE. */
+void
+swap_read (size_t slot, void *kpage)
+{
+  uint8_t *p = kpage;
+  size_t i;
+
+  ASSERT (slot < bitmap_size (swap_map));
+  for (i = 0; i < SLOT_SECTORS; i++)
+    block_read (swap_device, slot * SLOT_SECTORS + i,
+                p + i * BLOCK_SECTOR_SIZE);
+  read_cnt++;
+}
+
+/* Writes KPAGE to swap slot SLOT. */
+void
+swap_write (size_t slot, const void *kpage)
+{
+  const uint8_t *p = kpage;
+  size_t i;
+
+  ASSERT (slot < bitmap_size (swap_map));
+  for (i = 0; i < SLOT_SECTORS; i++)
+    block_write (swap_device, slot * SLOT_SECTORS + i,
+                 p + i * BLOCK_SECTOR_SIZE);
+  write_cnt++;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  if (swap_map == NULL)
+    return;
+  printf ("Swap: %zu of %zu slots in use, %lld pages read, "
+          "%lld pages written\n",
+          bitmap_count (swap_map, 0, bitmap_size (swap_map), true),
+          bitmap_size (swap_map), read_cnt, write_cnt);
+}